@@ -11,10 +11,15 @@
 #define DPU_MAX_NUMBER_OF_SEQUENCES_MRAM 16384LU          // Max of total sequences in dpu
 #define SCORE_METADATA_MAX_NUMBER_OF_SCORES 4096LU        // Max number of total alignment in dpu
 #define SCORE_METADATA_MAX_NUMBER_OF_SCORES_MRAM 131072LU // Max number of total alignment in dpu
-#define SCORE_METADATA_MAX_NUMBER_OF_SET 36LU             // Max number of set in a dpu
+#define SCORE_METADATA_MAX_NUMBER_OF_SET 36LU             // Max number of pair blocks (whole sets or parts of sets) in a dpu
 #define SCORE_MAX_SEQUENCES_TOTAL_SIZE 3840000LU          // 4MB of MRAM for sequences
 #define METADATA_MAX_NUMBER_OF_SCORES 4096LU              // Max number of pair alignment
 #define MAX_CIGAR_SIZE 32000000LU                         // 32MB of MRAM for cigars
+#define CIGAR_SCRATCH_SIZE 40960LU                        // Runs of a traceback before their copy to the cigars, more than the 40000 operations of the trace buffers
+#define CIGAR_RUN_MAX 64LU                                // Max length of a run in a run-length encoded cigar byte
+#define SCORE_MAILBOX_MAX_JOBS 16LU                       // Max number of jobs run by a single launch of the score kernel
+#define SCORE_TILE_MAX_NUMBER_OF_SEQUENCES 8192LU         // Max number of sequences of a tile block, half of the score sequence metadata
+#define SCORE_TILE_MAX_SEQUENCES_SIZE 1920000LU           // Max size of a tile block, half of the sequence buffer
 #define DPU_MAX_SEQUENCE_SIZE 80000LU                     // Is use for direction bit array
 #define W_MAX 128LU                                       // Width of anti-diagonal use in dpu
 
@@ -33,6 +38,16 @@ typedef enum
     UP = 3,     /// score is from upper gap
 } TraceValue;
 
+/**
+ * @brief CIGARs are run-length encoded, one byte per run of a same operation:
+ * the TraceValue of the operation on bits 0-1 (DMISS 'X', DMATCH '=', LEFT 'I', UP 'D')
+ * and the run length minus one on bits 2-7.
+ *
+ */
+#define CIGAR_RUN(op, length) ((uint8_t)((op) | (((length)-1) << 2)))
+#define CIGAR_RUN_OP(run) ((run)&3)
+#define CIGAR_RUN_LENGTH(run) (((run) >> 2) + 1)
+
 /**
  * @brief Represent the direction of the next band to compute
  *
@@ -44,6 +59,32 @@ typedef enum
     RIGHT = 1 /// band goes right
 } Direction;
 
+/**
+ * @brief Pairs of sequences to align: every pair of the sequences [rows, rows + row_count) with
+ * the sequences [cols, cols + col_count), or every pair of distinct sequences of the block when
+ * rows == cols and row_count == col_count. The pair of a sequence with itself is skipped, a star
+ * block has its representative as single row among its columns. Indexes are the ones of the
+ * sequences sent to the dpu, pairs are aligned row by row.
+ *
+ */
+typedef struct NwPairBlock
+{
+    uint16_t rows;      /// first sequence of the rows
+    uint16_t row_count; /// number of rows
+    uint16_t cols;      /// first sequence of the columns
+    uint16_t col_count; /// number of columns
+} NwPairBlock;
+
+/**
+ * @brief Pair of an explicit pair list, indexes are the ones of the sequences sent to the dpu
+ *
+ */
+typedef struct NwPair
+{
+    uint16_t s1; /// first sequence
+    uint16_t s2; /// second sequence
+} NwPair;
+
 /**
  * @brief Structure for data exchange between host and DPU.
  * Contains index and length of sequences. Sequence buffer is
@@ -56,13 +97,13 @@ typedef struct NwMetadataDPU
     /// @brief Collection of all common data needed for N&W
     uint32_t indexes[DPU_MAX_NUMBER_OF_SEQUENCES];       /// index of Nth sequence in sequence buffer
     uint16_t lengths[DPU_MAX_NUMBER_OF_SEQUENCES];       /// length of Nth sequence
-    uint8_t set_sizes[SCORE_METADATA_MAX_NUMBER_OF_SET]; /// Size of each set sent. Max set size is 255
-    uint32_t number_of_sets;                             /// number of total set sent
-    int32_t match;                                       /// match score
-    int32_t mismatch;                                    /// mismatch score
-    int32_t gap_opening;                                 /// gap opening score
-    int32_t gap_extension;                               /// gap extension score
-    // int8_t pad[4];                                       /// padding for mram compliance
+    NwPairBlock blocks[SCORE_METADATA_MAX_NUMBER_OF_SET]; /// pairs to align, a whole set or a part of a big one each
+    uint32_t number_of_blocks;                            /// number of blocks sent, none of them is empty
+    int32_t match;                                        /// match score
+    int32_t mismatch;                                     /// mismatch score
+    int32_t gap_opening;                                  /// gap opening score
+    int32_t gap_extension;                                /// gap extension score
+    uint32_t number_of_pairs;                             /// pairs of the explicit pair list, the blocks are ignored if not 0
 } NwMetadataDPU;
 
 typedef struct NwSequenceMetadataMram
@@ -72,7 +113,9 @@ typedef struct NwSequenceMetadataMram
 } NwSequenceMetadataMram;
 
 /**
- * @brief Represents the needed parameters to compute upper triangular comparison matrix
+ * @brief Represents the needed parameters to compute upper triangular comparison matrix.
+ * Pairs are taken row by row, the columns of row i being [max(col_begin, i + 1), size):
+ * the whole triangle with col_begin 0, or a rectangle of rows before col_begin.
  *
  */
 typedef struct ComparisonMetadata
@@ -82,20 +125,50 @@ typedef struct ComparisonMetadata
     uint32_t start_col; /// Starting column for comparison matrix
     uint32_t count;     /// How many comparison to do
     uint32_t size;      /// Total number of sequence to compare (comparison matrix size)
+    uint32_t col_begin; /// First column of each row
+    uint32_t pad;       /// padding for transfer alignment
 } ComparisonMetadata;
 
+/**
+ * @brief Jobs run one after the other by a single launch of the score kernel,
+ * the tasklets stay resident between jobs. Scores of the jobs are written one
+ * after the other in the output, in job order.
+ *
+ */
+typedef struct NwScoreMailbox
+{
+    uint32_t number_of_jobs;                        /// number of jobs posted
+    uint32_t best_hits;                             /// rows whose best hit is reduced once the jobs are done, 0 for none
+    ComparisonMetadata jobs[SCORE_MAILBOX_MAX_JOBS]; /// posted jobs
+} NwScoreMailbox;
+
+/**
+ * @brief Best hit of a row of the score jobs: its best score and the first column reaching it,
+ * counted from the col_begin of the job
+ *
+ */
+typedef struct NwScoreHit
+{
+    int32_t score;   /// best score
+    uint32_t target; /// column of the best score
+} NwScoreHit;
+
 /**
  * @brief Structure for data send back from DPU to host.
  * Contains the perfcounter, score of each pair alignment
- * and lenght of all cigars. CIGARs are sent separatly.
+ * and lenght of all cigars. CIGARs are sent separatly, packed
+ * at the start of the cigars buffer in the order they are done, each one 8 bytes aligned.
  *
  */
 typedef struct NwCigarOutput
 {
     /// @brief Relevant data
     uint64_t perf_counter;                           /// performance counter, cycle or instruction can be change on dpu code size.
+    uint32_t cigar_bytes;                            /// bytes of the cigars buffer used
+    uint32_t pad;                                    /// padding for transfer alignment
     int32_t scores[METADATA_MAX_NUMBER_OF_SCORES];   /// score of pair alignment
-    uint16_t lengths[METADATA_MAX_NUMBER_OF_SCORES]; /// length of CIGARs
+    uint16_t lengths[METADATA_MAX_NUMBER_OF_SCORES]; /// number of runs of run-length encoded CIGARs
+    uint32_t offsets[METADATA_MAX_NUMBER_OF_SCORES]; /// offset of each CIGAR in the cigars buffer
 } NwCigarOutput;
 
 /**
@@ -18,8 +18,9 @@
 __host NwMetadataDPU metadata;
 __mram NwSequenceMetadataMram sequence_metadata;
 
-__host ComparisonMetadata meta_index;
+__host NwScoreMailbox mailbox;
 __mram NwScoreOutput output;
+__mram_noinit NwScoreHit hits[SCORE_TILE_MAX_NUMBER_OF_SEQUENCES];
 
 __dma_aligned uint8_t buf_av[NR_GROUPS][W_MAX];
 __dma_aligned uint8_t buf_bv[NR_GROUPS][W_MAX];
@@ -102,10 +103,13 @@ extern uint64_t nw_perf_cnt;
 uint32_t seq1_id = 0;
 uint32_t seq2_id = 1;
 uint32_t score_offset = 0;
+ComparisonMetadata job;   // job being run
+uint32_t job_output = 0; // output index of the first score of the job
 
 MUTEX_INIT(seq_id_mutex);
 MUTEX_INIT(score_mutex);
 BARRIER_INIT(start_barrier, NR_TASKLETS);
+BARRIER_INIT(job_barrier, NR_GROUPS);
 BARRIER_INIT(end_barrier, NR_GROUPS);
 
 void next_pair()
@@ -113,10 +117,10 @@ void next_pair()
   score_offset++;
   seq2_id++;
 
-  if (seq2_id == meta_index.size)
+  if (seq2_id == job.size)
   {
     seq1_id++;
-    seq2_id = seq1_id + 1;
+    seq2_id = seq1_id + 1 > job.col_begin ? seq1_id + 1 : job.col_begin;
   }
 }
 
@@ -130,6 +134,44 @@ static inline uint32_t triangular_index(uint32_t i, uint32_t j, uint32_t n)
   return sum_integers(n) - sum_integers(n - i) + j - i - 1;
 }
 
+/**
+ * @brief Reduces the scores of all the jobs to the best hit of each row, the first column on ties.
+ * Rows are read in pair order, so the columns of a row come in increasing order.
+ *
+ */
+static void reduce_best_hits()
+{
+  for (uint32_t r = 0; r < mailbox.best_hits; r++)
+  {
+    hits[r].score = INT32_MIN;
+    hits[r].target = 0;
+  }
+
+  uint32_t offset = 0;
+  for (uint32_t j = 0; j < mailbox.number_of_jobs; j++)
+  {
+    const ComparisonMetadata *jb = &mailbox.jobs[j];
+    uint32_t row = jb->start_row;
+    uint32_t col = jb->start_col;
+
+    for (uint32_t k = 0; k < jb->count; k++, offset++)
+    {
+      const int32_t score = output.scores[offset];
+      if (row < mailbox.best_hits && score > hits[row].score)
+      {
+        hits[row].score = score;
+        hits[row].target = col - jb->col_begin;
+      }
+
+      if (++col == jb->size)
+      {
+        row++;
+        col = row + 1 > jb->col_begin ? row + 1 : jb->col_begin;
+      }
+    }
+  }
+}
+
 int main()
 {
   // 1) set a global ID (under mutex) to define for each tasklet
@@ -138,9 +180,7 @@ int main()
   if (me() == 0)
   {
     mem_reset();
-    score_offset = 0;
-    seq1_id = meta_index.start_row;
-    seq2_id = meta_index.start_col;
+    job_output = 0;
 
     perfcounter_config(PERF_COUNT_TYPE, true);
   }
@@ -149,35 +189,55 @@ int main()
 
   wait_for_work();
 
-  while (true)
+  // only the group masters run the jobs, the other tasklets are woken up by their master
+  for (uint32_t j = 0; j < mailbox.number_of_jobs; j++)
   {
-    mutex_lock(seq_id_mutex);
-    uint32_t local_score_offset = score_offset;
-    uint32_t seq1 = seq1_id;
-    uint32_t seq2 = seq2_id;
-    next_pair();
-
-    mutex_unlock(seq_id_mutex);
-
-    if (local_score_offset >= meta_index.count)
-      break;
-
-    // set parameter for the alignment group
-    const uint32_t pool_id = group();
-    align_data[pool_id].s1 = seq1;
-    align_data[pool_id].s2 = seq2;
-    align_data[pool_id].s_off = local_score_offset;
-
-    int score = align();
-    mutex_lock(score_mutex);
-    output.scores[local_score_offset] = score;
-    mutex_unlock(score_mutex);
-  }
+    if (me() == 0)
+    {
+      job = mailbox.jobs[j];
+      score_offset = 0;
+      seq1_id = job.start_row;
+      seq2_id = job.start_col;
+    }
+    barrier_wait(&job_barrier);
+
+    while (true)
+    {
+      mutex_lock(seq_id_mutex);
+      uint32_t local_score_offset = score_offset;
+      uint32_t seq1 = seq1_id;
+      uint32_t seq2 = seq2_id;
+      next_pair();
+
+      mutex_unlock(seq_id_mutex);
+
+      if (local_score_offset >= job.count)
+        break;
+
+      // set parameter for the alignment group
+      const uint32_t pool_id = group();
+      align_data[pool_id].s1 = seq1;
+      align_data[pool_id].s2 = seq2;
+      align_data[pool_id].s_off = local_score_offset;
+
+      int score = align();
+      mutex_lock(score_mutex);
+      output.scores[job_output + local_score_offset] = score;
+      mutex_unlock(score_mutex);
+    }
+
+    barrier_wait(&end_barrier);
 
-  barrier_wait(&end_barrier);
+    if (me() == 0)
+      job_output += job.count;
+  }
 
   if (me() == 0)
+  {
+    if (mailbox.best_hits != 0)
+      reduce_best_hits();
     output.perf_counter = perfcounter_get();
+  }
 
   return 0;
 }
@@ -22,7 +22,8 @@ __mram_noinit uint8_t dirs[NR_GROUPS][DPU_MAX_SEQUENCE_SIZE * 2 / 8]; // Bit arr
 
 __mram_noinit NwCigarOutput output;
 __mram_noinit uint8_t cigars[MAX_CIGAR_SIZE];
-__mram_noinit uint32_t cigar_indexes[METADATA_MAX_NUMBER_OF_SCORES];
+__mram_noinit uint8_t cigar_scratch[NR_GROUPS][CIGAR_SCRATCH_SIZE];
+__mram_noinit NwPair pairs[METADATA_MAX_NUMBER_OF_SCORES];
 
 WramAligned64 dna_reader_buffer1;
 WramAligned64 dna_reader_buffer2;
@@ -38,15 +39,68 @@ __dma_aligned uint8_t buf_bv[NR_GROUPS][W_MAX];
 
 MUTEX_INIT(lenghts_mutex);
 MUTEX_INIT(scores_mutex);
+MUTEX_INIT(cigars_mutex);
 
-void reverse(__mram_ptr uint8_t *mram, size_t size)
+uint32_t cigar_bytes = 0;
+
+/**
+ * @brief Run-length encoder of the cigar operations found by the traceback.
+ * Runs are written from the end of the alignment to its start, the host reverses them.
+ *
+ */
+typedef struct cigar_rle
 {
-  for (size_t i = 0; i < size / 2; i++)
+  mram_buffered_array_64 *out; /// cigar scratch of the group
+  uint32_t runs;               /// number of runs written
+  uint8_t op;                  /// operation of the current run
+  uint8_t length;              /// length of the current run, 0 before the first operation
+} cigar_rle;
+
+static inline void cigar_rle_flush(cigar_rle *rle)
+{
+  if (rle->length != 0)
+    mram_buffered_array_64_set(rle->out, rle->runs++, CIGAR_RUN(rle->op, rle->length));
+  rle->length = 0;
+}
+
+static inline void cigar_rle_push(cigar_rle *rle, uint8_t op)
+{
+  if (rle->op != op || rle->length == CIGAR_RUN_MAX)
+    cigar_rle_flush(rle);
+  rle->op = op;
+  rle->length++;
+}
+
+/**
+ * @brief Copies the cigar of a pair from the scratch of its group to the cigars, after the ones already copied.
+ * Cigars are 8 bytes aligned so that two groups never write the same MRAM word, the host sized the buffer
+ * for the worst case of its pairs.
+ *
+ * @param pool_id group of the pair
+ * @param pair offset of the pair in the output
+ * @param runs number of runs of its cigar
+ */
+static void store_cigar(uint32_t pool_id, uint32_t pair, uint32_t runs)
+{
+  uint8_t *buffer = dna_reader_buffer1.buffer + 64LU * pool_id;
+  const uint32_t size = (runs + 7U) & ~7U;
+
+  mutex_lock(cigars_mutex);
+  const uint32_t offset = cigar_bytes;
+  cigar_bytes += size;
+  mutex_unlock(cigars_mutex);
+
+  for (uint32_t c = 0; c < size; c += 64)
   {
-    uint8_t tmp = mram[size - 1 - i];
-    mram[size - 1 - i] = mram[i];
-    mram[i] = tmp;
+    const uint32_t n = (size - c < 64) ? size - c : 64;
+    mram_read(&cigar_scratch[pool_id][c], buffer, n);
+    mram_write(buffer, &cigars[offset + c], n);
   }
+
+  mutex_lock(lenghts_mutex);
+  output.lengths[pair] = runs;
+  output.offsets[pair] = offset;
+  mutex_unlock(lenghts_mutex);
 }
 
 void align_initialisations()
@@ -158,14 +212,14 @@ int align()
 
   mram_buffered_array_64 res = get_mram_buffered_array_64(
       &dna_reader_buffer1,
-      &cigars[cigar_indexes[align_data[pool_id].s_off]],
+      cigar_scratch[pool_id],
       pool_id);
+  cigar_rle rle = {&res, 0, DMATCH, 0};
   mram_2bits_array_64 trace_reader = create_mram_2bits_array_64(&dna_reader_buffer2, trace_buffer[pool_id], pool_id);
   mram_bit_array_32 te_reader = create_mram_bit_array_32(&t_e_wram_buffer, te_buffer[pool_id], pool_id);
   mram_bit_array_32 tf_reader = create_mram_bit_array_32(&t_f_wram_buffer, tf_buffer[pool_id], pool_id);
 
-  uint32_t sp = 0; // number of steps, gives the cigar final size.
-  for (; d >= 0; sp++)
+  while (d >= 0)
   {
 
     Direction direction = mram_bit_array_32_get(&align_data[pool_id].direction_array, d);
@@ -184,12 +238,8 @@ int align()
     switch (current_trace)
     {
     case DMATCH:
-      mram_buffered_array_64_set(&res, sp, '=');
-      offset -= 2 * W_MAX + o2, d--;
-      break;
-
     case DMISS:
-      mram_buffered_array_64_set(&res, sp, 'X');
+      cigar_rle_push(&rle, current_trace);
       offset -= 2 * W_MAX + o2, d--;
       break;
 
@@ -197,17 +247,16 @@ int align()
       // if gap, need to go back up to the gap beginning.
       while (mram_bit_array_32_get(&tf_reader, offset) == 0)
       {
-        mram_buffered_array_64_set(&res, sp, 'I');
+        cigar_rle_push(&rle, LEFT);
         offset -= W_MAX + o;
         d--;
-        sp++;
         if (d < 0)
           break;
         direction = mram_bit_array_32_get(&align_data[pool_id].direction_array, d);
         o = (direction == RIGHT) ? 0 : 1;
       }
 
-      mram_buffered_array_64_set(&res, sp, 'I');
+      cigar_rle_push(&rle, LEFT);
       offset -= W_MAX + o;
       break;
 
@@ -215,16 +264,15 @@ int align()
       // if gap, need to go back up to the gap beginning.
       while (mram_bit_array_32_get(&te_reader, offset) == 0)
       {
-        mram_buffered_array_64_set(&res, sp, 'D');
+        cigar_rle_push(&rle, UP);
         offset -= W_MAX - 1 + o;
         d--;
-        sp++;
         if (d < 0)
           break;
         direction = mram_bit_array_32_get(&align_data[pool_id].direction_array, d);
         o = (direction == RIGHT) ? 0 : 1;
       }
-      mram_buffered_array_64_set(&res, sp, 'D');
+      cigar_rle_push(&rle, UP);
       offset -= W_MAX - 1 + o;
       break;
     }
@@ -232,49 +280,151 @@ int align()
     d--;
   }
 
-  mutex_lock(lenghts_mutex);
-  output.lengths[align_data[pool_id].s_off] = sp;
-  mutex_unlock(lenghts_mutex);
-
+  cigar_rle_flush(&rle);
   mram_buffered_array_64_flush(&res);
 
-  // traceback is from end to start. cigar needs to be change to start to end.
-  reverse(&cigars[cigar_indexes[align_data[pool_id].s_off]], sp);
+  store_cigar(pool_id, align_data[pool_id].s_off, rle.runs);
 
   return align_data[pool_id].pv[(W_MAX >> 1) + (down - align_data[pool_id].l2)];
 }
 
 extern uint64_t nw_perf_cnt;
 
-uint32_t set_id = 0;
+uint32_t block_id = 0;
 uint32_t seq1_id = 0;
 uint32_t seq2_id = 1;
 uint32_t score_offset = 0;
-uint32_t set_offset = 0;
 
 MUTEX_INIT(seq_id_mutex);
 BARRIER_INIT(start_barrier, NR_TASKLETS);
 BARRIER_INIT(end_barrier, NR_GROUPS);
 
+/**
+ * @brief Returns true if the block holds the distinct pairs of its sequences
+ *
+ */
+static inline bool triangle(const NwPairBlock *block)
+{
+  return block->rows == block->cols && block->row_count == block->col_count;
+}
+
+/**
+ * @brief First column of a row of a block, the pairs of a block with itself are its distinct pairs
+ *
+ */
+static inline uint32_t first_col(const NwPairBlock *block, uint32_t row)
+{
+  return triangle(block) ? row + 1 : 0;
+}
+
+/**
+ * @brief Number of rows of a block with at least one pair
+ *
+ */
+static inline uint32_t block_rows(const NwPairBlock *block)
+{
+  return triangle(block) ? block->row_count - 1U : block->row_count;
+}
+
+/**
+ * @brief Returns true if the pair is a sequence with itself, the representative of a star block is among its columns
+ *
+ */
+static inline bool self_pair(const NwPairBlock *block, uint32_t row, uint32_t col)
+{
+  return block->rows + row == block->cols + col;
+}
+
+/**
+ * @brief Returns true if the block has at least one pair, a triangle needs two sequences
+ *
+ */
+static inline bool has_pairs(const NwPairBlock *block)
+{
+  return block->row_count != 0 && block->col_count > first_col(block, 0);
+}
+
+/**
+ * @brief Moves to the first pair of the current block or of the next ones, skipping the blocks without pairs.
+ * Blocks are only read below number_of_blocks, past the last one block_id is left equal to it.
+ *
+ */
+static void start_block()
+{
+  while (block_id < metadata.number_of_blocks && !has_pairs(&metadata.blocks[block_id]))
+    block_id++;
+
+  seq1_id = 0;
+  seq2_id = block_id < metadata.number_of_blocks ? first_col(&metadata.blocks[block_id], 0) : 0;
+}
+
+static void step_pair()
+{
+  if (block_id >= metadata.number_of_blocks)
+    return;
+
+  const NwPairBlock *block = &metadata.blocks[block_id];
+
+  seq2_id++;
+  if (seq2_id == block->col_count)
+  {
+    seq1_id++;
+    seq2_id = first_col(block, seq1_id);
+  }
+  if (seq1_id == block_rows(block))
+  {
+    block_id++;
+    start_block();
+  }
+}
+
+static void skip_self_pairs()
+{
+  while (block_id < metadata.number_of_blocks && self_pair(&metadata.blocks[block_id], seq1_id, seq2_id))
+    step_pair();
+}
+
 void next_pair()
 {
   score_offset++;
-  seq2_id++;
+  step_pair();
+  skip_self_pairs();
+}
 
-  uint8_t set_size = metadata.set_sizes[set_id];
+/**
+ * @brief Takes the next pair to align, from the explicit pair list if one was sent, otherwise from the blocks
+ *
+ * @return false once all the pairs are taken
+ */
+static bool take_pair(uint32_t *seq1, uint32_t *seq2, uint32_t *offset)
+{
+  bool found;
 
-  if (seq2_id == set_size)
+  mutex_lock(seq_id_mutex);
+  *offset = score_offset;
+  if (metadata.number_of_pairs != 0)
   {
-    seq1_id++;
-    seq2_id = seq1_id + 1;
+    found = score_offset < metadata.number_of_pairs;
+    if (found)
+    {
+      *seq1 = pairs[score_offset].s1;
+      *seq2 = pairs[score_offset].s2;
+      score_offset++;
+    }
   }
-  if (seq1_id == set_size - 1)
+  else
   {
-    seq1_id = 0;
-    seq2_id = 1;
-    set_offset += set_size;
-    set_id++;
+    found = block_id < metadata.number_of_blocks;
+    if (found)
+    {
+      *seq1 = metadata.blocks[block_id].rows + seq1_id;
+      *seq2 = metadata.blocks[block_id].cols + seq2_id;
+      next_pair();
+    }
   }
+  mutex_unlock(seq_id_mutex);
+
+  return found;
 }
 
 int main()
@@ -285,39 +435,29 @@ int main()
   if (me() == 0)
   {
     mem_reset();
-    set_id = 0;
+    block_id = 0;
     score_offset = 0;
-    set_offset = 0;
-    seq1_id = 0;
-    seq2_id = 1;
+    cigar_bytes = 0;
+    start_block();
+    skip_self_pairs();
 
-    // perfcounter_config(PERF_COUNT_TYPE, true);
+    perfcounter_config(PERF_COUNT_TYPE, true);
   }
   tasklet_params[me()].start = (me() % 4) * 32;
   barrier_wait(&start_barrier);
 
   wait_for_work();
 
-  while (true)
-  {
-    mutex_lock(seq_id_mutex);
-    uint32_t local_score_offset = score_offset;
-    uint32_t local_set_offset = set_offset;
-    uint32_t local_set_id = set_id;
-    uint32_t seq1 = seq1_id;
-    uint32_t seq2 = seq2_id;
-
-    next_pair();
-
-    mutex_unlock(seq_id_mutex);
-
-    if (local_set_id >= metadata.number_of_sets)
-      break;
+  uint32_t seq1;
+  uint32_t seq2;
+  uint32_t local_score_offset;
 
+  while (take_pair(&seq1, &seq2, &local_score_offset))
+  {
     // set parameter for the alignment group
     const uint32_t pool_id = group();
-    align_data[pool_id].s1 = local_set_offset + seq1;
-    align_data[pool_id].s2 = local_set_offset + seq2;
+    align_data[pool_id].s1 = seq1;
+    align_data[pool_id].s2 = seq2;
     align_data[pool_id].s_off = local_score_offset;
 
     int tmp_s = align();
@@ -328,8 +468,12 @@ int main()
 
   barrier_wait(&end_barrier);
 
+  // the counter covers the alignments only
   if (me() == 0)
+  {
     output.perf_counter = perfcounter_get();
+    output.cigar_bytes = cigar_bytes;
+  }
 
   return 0;
 }
@@ -1,21 +1,193 @@
 #ifndef CACF6DF8_0DCE_4D9D_8EC6_5061ECA11076
 #define CACF6DF8_0DCE_4D9D_8EC6_5061ECA11076
 
+#include <array>
+#include <cstddef>
+
 #include "dpu_common.hpp"
 #include "Rank.hpp"
 
+/**
+ * @brief Split of a dataset too big for the buffers of a dpu in blocks of consecutive sequences.
+ * The score matrix is computed by tiles, the pairs of a row block with a column block: a dpu holds only
+ * the two blocks of its tile, the row block in the first half of its sequence buffers, the column block in the second.
+ *
+ */
+struct ScoreTiling
+{
+    const SequenceStore *store{};
+    std::vector<size_t> blocks{0}; /// first sequence of each block, plus the number of sequences
+
+    /**
+     * @brief Cuts the dataset in blocks of at most block_size sequences fitting half of the dpu buffers
+     *
+     * @param set dataset
+     * @param block_size
+     * @param begin first sequence of the first block, the sequences before are not tiled
+     * @param split a block starts at this sequence, the end of the rows of a shard
+     */
+    ScoreTiling(const SequenceStore &set, size_t block_size, size_t begin = 0, size_t split = 0) : store(&set), blocks{begin}
+    {
+        block_size = std::min(block_size, SCORE_TILE_MAX_NUMBER_OF_SEQUENCES);
+        for (size_t i = begin; i < set.size(); i++)
+        {
+            const auto first = blocks.back();
+            const auto end = set.offsets[i] + compressed_size(set.length(i)) - set.offsets[first];
+            if (i != first && (i - first == block_size || end > SCORE_TILE_MAX_SEQUENCES_SIZE || i == split))
+                blocks.push_back(i);
+        }
+        if (set.size() > begin)
+            blocks.push_back(set.size());
+    }
+
+    /// @brief Number of blocks starting before a sequence
+    size_t blocks_before(size_t sequence) const
+    {
+        return static_cast<size_t>(std::ranges::lower_bound(blocks.begin(), blocks.end() - 1, sequence) - blocks.begin());
+    }
+
+    size_t size() const { return blocks.size() - 1; }
+    size_t first(size_t b) const { return blocks[b]; }
+    size_t count(size_t b) const { return blocks[b + 1] - blocks[b]; }
+};
+
 class App16S
 {
+    static constexpr size_t no_block = SIZE_MAX;
+
+    /// @brief Sequences of a tile block as laid out in one half of the dpu buffers
+    struct BlockBuffer
+    {
+        std::vector<uint8_t> data{};
+        std::vector<uint32_t> indexes{};
+        std::vector<uint16_t> lengths{};
+    };
 
 public:
-    std::vector<ComparisonMetadata> meta{};
+    std::vector<NwScoreMailbox> mailboxes{};
     std::vector<NwScoreOutput> outputs{};
-    std::vector<int> *p_results;
+    ScoreMatrix *p_results;
+
+    /// @brief Tiled dataset, nullptr when the whole dataset is broadcast to the dpus
+    const ScoreTiling *tiling{};
+    const ScoreTiling *columns{}; /// blocks of the columns, the same as tiling for an all against all
+    SearchHits *p_hits{};         /// best hits of the queries (rows) of a search, nullptr for a score matrix
+    std::vector<std::vector<NwScoreHit>> hits{};
+    std::vector<std::array<size_t, 2>> tiles{};    /// row and column block of the tile of each dpu
+    std::vector<std::array<size_t, 2>> resident{}; /// block held by each half of the buffers of each dpu
+    std::vector<std::array<BlockBuffer, 2>> block_buffers{};
 
     inline void init(size_t size)
     {
-        meta.resize(size);
+        mailboxes.resize(size);
         outputs.resize(size);
+        hits.resize(size);
+        tiles.assign(size, {no_block, no_block});
+        resident.assign(size, {no_block, no_block});
+        block_buffers.resize(size);
+    }
+
+    /**
+     * @brief Uploads the blocks of one half of the buffers if the tile of any dpu needs another one.
+     * A transfer moves the same size for every dpu, so the whole rank is sent: the rows of a tile only change
+     * once the dpus of the rank are done with all their columns. A block wanted by all the dpus is broadcast.
+     *
+     * @param rank
+     * @param half 0 for row blocks, 1 for column blocks
+     */
+    void send_blocks(Rank<App16S> &rank, size_t half)
+    {
+        const auto n_dpu = tiles.size();
+        const auto &blocks = half == 0 ? *tiling : *columns;
+        std::vector<size_t> wanted(n_dpu, no_block);
+        bool changed = false;
+        for (size_t i = 0; i < n_dpu; i++)
+        {
+            const auto [r, c] = tiles[i];
+            if (r != no_block && (half == 0 || !square(r, c)))
+                wanted[i] = half == 0 ? r : c;
+            changed |= wanted[i] != no_block && wanted[i] != resident[i][half];
+        }
+        if (!changed)
+            return;
+
+        const bool broadcast = std::ranges::all_of(wanted, [&](size_t b)
+                                                   { return b == wanted[0]; });
+
+        size_t bytes = 0;
+        size_t count = 0;
+        for (size_t i = 0; i < (broadcast ? 1 : n_dpu); i++)
+        {
+            auto &buffer = block_buffers[i][half];
+            buffer.data.clear();
+            buffer.indexes.clear();
+            buffer.lengths.clear();
+            if (wanted[i] != no_block)
+            {
+                const auto first = blocks.first(wanted[i]);
+                const auto last = first + blocks.count(wanted[i]);
+                const auto packed = blocks.store->packed_range(first, last);
+                buffer.data.assign(packed.begin(), packed.end());
+                for (auto q = first; q < last; q++)
+                {
+                    const auto offset = blocks.store->offsets[q] - blocks.store->offsets[first];
+                    buffer.indexes.push_back(static_cast<uint32_t>(half * SCORE_TILE_MAX_SEQUENCES_SIZE + offset));
+                    buffer.lengths.push_back(static_cast<uint16_t>(blocks.store->length(q)));
+                }
+            }
+            bytes = std::max(bytes, buffer.data.size());
+            count = std::max(count, buffer.lengths.size());
+        }
+        for (size_t i = 0; i < n_dpu; i++)
+            resident[i][half] = wanted[i];
+
+        // transfers are multiples of 8 bytes
+        bytes = (bytes + 7) & ~7UL;
+        count = (count + 3) & ~3UL;
+        for (size_t i = 0; i < (broadcast ? 1 : n_dpu); i++)
+        {
+            block_buffers[i][half].data.resize(bytes);
+            block_buffers[i][half].indexes.resize(count);
+            block_buffers[i][half].lengths.resize(count);
+        }
+
+        const auto indexes_offset = offsetof(NwSequenceMetadataMram, indexes) + half * SCORE_TILE_MAX_NUMBER_OF_SEQUENCES * sizeof(uint32_t);
+        const auto lengths_offset = offsetof(NwSequenceMetadataMram, lengths) + half * SCORE_TILE_MAX_NUMBER_OF_SEQUENCES * sizeof(uint16_t);
+
+        if (broadcast)
+        {
+            const auto &buffer = block_buffers[0][half];
+            DPU_ASSERT(dpu_broadcast_to(rank.get(), "sequences", half * SCORE_TILE_MAX_SEQUENCES_SIZE,
+                                        buffer.data.data(), bytes, DPU_XFER_ASYNC));
+            DPU_ASSERT(dpu_broadcast_to(rank.get(), "sequence_metadata", indexes_offset,
+                                        buffer.indexes.data(), count * sizeof(uint32_t), DPU_XFER_ASYNC));
+            DPU_ASSERT(dpu_broadcast_to(rank.get(), "sequence_metadata", lengths_offset,
+                                        buffer.lengths.data(), count * sizeof(uint16_t), DPU_XFER_ASYNC));
+            return;
+        }
+
+        dpu_set_t dpu{};
+        uint32_t each_dpu = 0;
+        DPU_FOREACH(rank.get(), dpu, each_dpu)
+        {
+            DPU_ASSERT(dpu_prepare_xfer(dpu, block_buffers[each_dpu][half].data.data()));
+        }
+        DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_TO_DPU, "sequences",
+                                 half * SCORE_TILE_MAX_SEQUENCES_SIZE, bytes, DPU_XFER_ASYNC));
+
+        DPU_FOREACH(rank.get(), dpu, each_dpu)
+        {
+            DPU_ASSERT(dpu_prepare_xfer(dpu, block_buffers[each_dpu][half].indexes.data()));
+        }
+        DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_TO_DPU, "sequence_metadata", indexes_offset,
+                                 count * sizeof(uint32_t), DPU_XFER_ASYNC));
+
+        DPU_FOREACH(rank.get(), dpu, each_dpu)
+        {
+            DPU_ASSERT(dpu_prepare_xfer(dpu, block_buffers[each_dpu][half].lengths.data()));
+        }
+        DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_TO_DPU, "sequence_metadata", lengths_offset,
+                                 count * sizeof(uint16_t), DPU_XFER_ASYNC));
     }
 
     void send(Rank<App16S> &rank)
@@ -23,12 +195,18 @@ public:
         dpu_set_t dpu{};
         uint32_t each_dpu = 0;
 
+        if (tiling != nullptr)
+        {
+            send_blocks(rank, 0);
+            send_blocks(rank, 1);
+        }
+
         DPU_FOREACH(rank.get(), dpu, each_dpu)
         {
-            DPU_ASSERT(dpu_prepare_xfer(dpu, &(meta[each_dpu])));
+            DPU_ASSERT(dpu_prepare_xfer(dpu, &(mailboxes[each_dpu])));
         }
-        DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_TO_DPU, "meta_index", 0,
-                                 sizeof(ComparisonMetadata), DPU_XFER_ASYNC));
+        DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_TO_DPU, "mailbox", 0,
+                                 offsetof(NwScoreMailbox, jobs) + number_of_jobs() * sizeof(ComparisonMetadata), DPU_XFER_ASYNC));
     }
 
     void gather(Rank<App16S> &rank)
@@ -36,7 +214,22 @@ public:
         dpu_set_t dpu{};
         uint32_t each_dpu = 0;
 
-        auto byte_size = static_cast<size_t>(meta[0].count * 4 + 16);
+        // a search only needs the best hit of each row
+        if (p_hits != nullptr)
+        {
+            uint32_t rows = 0;
+            for (const auto &mailbox : mailboxes)
+                rows = std::max(rows, mailbox.best_hits);
+            DPU_FOREACH(rank.get(), dpu, each_dpu)
+            {
+                hits[each_dpu].resize(rows);
+                DPU_ASSERT(dpu_prepare_xfer(dpu, hits[each_dpu].data()));
+            }
+            DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_FROM_DPU, "hits", 0, rows * sizeof(NwScoreHit), DPU_XFER_ASYNC));
+            return;
+        }
+
+        auto byte_size = static_cast<size_t>(max_scores() * 4 + 16);
         byte_size &= ~7;
         byte_size = std::min(byte_size, sizeof(NwScoreOutput));
 
@@ -56,14 +249,32 @@ public:
     {
         auto &algo = *static_cast<App16S *>(_arg);
 
-        for (size_t i = 0; i < algo.meta.size(); i++)
+        for (size_t i = 0; i < algo.mailboxes.size(); i++)
         {
-            auto idx = triangular_index(algo.meta[i].start_row, algo.meta[i].start_col, algo.meta[i].size);
+            const auto &mailbox = algo.mailboxes[i];
+            const int32_t *scores = algo.outputs[i].scores;
+
+            if (algo.p_hits != nullptr)
+            {
+                if (mailbox.number_of_jobs != 0)
+                    algo.merge_hits(algo.tiles[i], algo.hits[i]);
+                continue;
+            }
+
+            if (algo.tiling != nullptr)
+            {
+                if (mailbox.number_of_jobs != 0)
+                    algo.store_tile(algo.tiles[i], mailbox.jobs[0], scores);
+                continue;
+            }
 
-            for (size_t j = 0; j < algo.meta[i].count; j++)
+            // scores of a job are consecutive in the triangular matrix, jobs follow each other in the output
+            for (uint32_t j = 0; j < mailbox.number_of_jobs; j++)
             {
-                algo.p_results->operator[](idx) = algo.outputs[i].scores[j];
-                idx++;
+                const auto &job = mailbox.jobs[j];
+                auto idx = triangular_index(job.start_row, job.start_col, job.size);
+                algo.p_results->store(idx, std::span<const int32_t>(scores, job.count));
+                scores += job.count;
             }
         }
 
@@ -86,18 +297,144 @@ public:
             meta.count--;
     }
 
-    void get_bucket(ComparisonMetadata &new_meta, size_t i)
+    /**
+     * @brief Stores the scores of a tile, row by row: each row is consecutive in the triangular matrix
+     *
+     * @param tile row and column block
+     * @param job comparisons of the tile
+     * @param scores output of the dpu
+     */
+    void store_tile(const std::array<size_t, 2> &tile, const ComparisonMetadata &job, const int32_t *scores) const
+    {
+        const auto [r, c] = tile;
+        const auto row = tiling->first(r);
+        const auto col = r == c ? row : tiling->first(c) - job.col_begin;
+        const auto n = tiling->store->size();
+
+        for (uint32_t i = 0; i < tiling->count(r); i++)
+        {
+            const auto first = std::max(job.col_begin, i + 1);
+            if (first >= job.size)
+                break;
+            p_results->store(triangular_index(row + i, col + first, n), std::span<const int32_t>(scores, job.size - first));
+            scores += job.size - first;
+        }
+    }
+
+    /**
+     * @brief Merges the best hits of the rows of a tile into the best hits of the queries
+     *
+     * @param tile query block and database block
+     * @param tile_hits best hit of each row of the tile
+     */
+    void merge_hits(const std::array<size_t, 2> &tile, std::span<const NwScoreHit> tile_hits) const
+    {
+        const auto [r, c] = tile;
+        const auto query = tiling->first(r);
+        const auto target = static_cast<uint32_t>(columns->first(c));
+
+        for (size_t i = 0; i < tiling->count(r); i++)
+            p_hits->merge(query + i, {tile_hits[i].score, tile_hits[i].target + target});
+    }
+
+    /// @brief A tile of a row block with itself, only its distinct pairs are aligned
+    bool square(size_t r, size_t c) const { return r == c && tiling == columns; }
+
+    /// @brief Most jobs posted to a mailbox
+    uint32_t number_of_jobs() const
+    {
+        uint32_t n = 0;
+        for (const auto &mailbox : mailboxes)
+            n = std::max(n, mailbox.number_of_jobs);
+        return n;
+    }
+
+    /// @brief Empties the mailboxes before posting the jobs of a new launch
+    void clear_jobs()
+    {
+        for (auto &mailbox : mailboxes)
+        {
+            mailbox.number_of_jobs = 0;
+            mailbox.best_hits = 0;
+        }
+        for (auto &tile : tiles)
+            tile = {no_block, no_block};
+    }
+
+    /// @brief Most scores computed by a dpu for the jobs posted
+    size_t max_scores() const
+    {
+        size_t max = 0;
+        for (const auto &mailbox : mailboxes)
+        {
+            size_t n = 0;
+            for (uint32_t j = 0; j < mailbox.number_of_jobs; j++)
+                n += mailbox.jobs[j].count;
+            max = std::max(max, n);
+        }
+        return max;
+    }
+
+    /**
+     * @brief Posts the tile of a row block and a column block to a dpu, as the only job of its mailbox.
+     * Rows are numbered from 0 and columns from SCORE_TILE_MAX_NUMBER_OF_SEQUENCES, the first index of the second half
+     * of the sequence metadata; a tile on the diagonal of a dataset tiled against itself is the triangle of its row block.
+     * For a search, the dpu reduces the scores of each row to its best hit.
+     *
+     * @param i dpu
+     * @param r row block
+     * @param c column block, c >= r for a dataset tiled against itself
+     */
+    void add_tile(size_t i, size_t r, size_t c)
+    {
+        const auto rows = static_cast<uint32_t>(tiling->count(r));
+        constexpr auto first_col = static_cast<uint32_t>(SCORE_TILE_MAX_NUMBER_OF_SEQUENCES);
+
+        tiles[i] = {r, c};
+        auto &mailbox = mailboxes[i];
+        if (square(r, c))
+        {
+            mailbox.jobs[0] = {0, 1, static_cast<uint32_t>(sum_integers(rows)), rows, 0, 0};
+        }
+        else
+        {
+            const auto cols = static_cast<uint32_t>(columns->count(c));
+            mailbox.jobs[0] = {0, first_col, rows * cols, first_col + cols, first_col, 0};
+        }
+        mailbox.number_of_jobs = mailbox.jobs[0].count == 0 ? 0 : 1;
+        mailbox.best_hits = p_hits != nullptr ? rows : 0;
+    }
+
+    /**
+     * @brief Returns true if a job of i comparisons can be added to the mailboxes
+     *
+     * @param i
+     */
+    bool fits(size_t i) const
+    {
+        const auto nr_dpu = mailboxes.size();
+        return number_of_jobs() < SCORE_MAILBOX_MAX_JOBS &&
+               max_scores() + (i + nr_dpu - 1) / nr_dpu <= SCORE_METADATA_MAX_NUMBER_OF_SCORES_MRAM;
+    }
+
+    /**
+     * @brief Splits the next i comparisons from new_meta between the dpus, as a new job of their mailbox
+     *
+     * @param new_meta first comparison not yet posted, updated
+     * @param i
+     */
+    void add_job(ComparisonMetadata &new_meta, size_t i)
     {
-        const auto nr_dpu = meta.size();
+        const auto nr_dpu = mailboxes.size();
         auto mean = i / nr_dpu;
         auto rest = static_cast<int>(i % nr_dpu);
 
         new_meta.count = static_cast<uint32_t>(mean + (rest != 0 ? 1 : 0));
         rest--;
 
-        for (auto &dpu : meta)
+        for (auto &mailbox : mailboxes)
         {
-            dpu = new_meta;
+            mailbox.jobs[mailbox.number_of_jobs++] = new_meta;
             update_meta(new_meta, rest);
         }
     }
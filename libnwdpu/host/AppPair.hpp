@@ -0,0 +1,325 @@
+#ifndef FD18857D_2B30_48D7_A18A_3993E4079FF9
+#define FD18857D_2B30_48D7_A18A_3993E4079FF9
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <unordered_map>
+
+#include "AppSet.hpp"
+
+/**
+ * @brief Aligns the pairs of an explicit pair list. A batch takes consecutive pairs of the list, sorted by their
+ * first sequence before being split between the dpus: a dpu receives each of its sequences once, and the pairs of a
+ * first sequence mostly land on the same dpu. A sequence shared by pairs of different dpus (or batches) is sent to each.
+ * Dpus iterate their pair list instead of blocks of pairs. The results and CIGARs of a batch are freed once written.
+ *
+ */
+class AppPair
+{
+public:
+    std::vector<NwInputCigar> inputs{};
+    std::vector<std::vector<NwPair>> pairs{};       /// pair list of each dpu, padded for the transfer
+    std::vector<std::vector<uint32_t>> positions{}; /// position in the batch of each pair of each dpu
+    std::vector<NwCigarOutput> outputs{};
+    std::vector<std::vector<uint8_t>> cigars{};
+    std::vector<size_t> cigar_bounds{}; /// worst case of the cigars of each dpu, in bytes
+    std::vector<CostSample> samples{};  /// work of each dpu, fits the cost model with its perf counter
+    std::shared_ptr<SetAlignments> batch{}; /// results of the pairs of the batch in list order, and their CIGARs
+    ResultWriter *writer{};            /// writes the results of the batch once post-processed
+    size_t chunk{};                    /// writer chunk of the batch
+    SetTransferStats *transfers{};     /// transfer counters, if set
+    CostModel *cost_model{};           /// sizes the batches, fitted with their perf counters, if set
+    CigarBudget *cigar_budget{};       /// predicts the cigars to fetch, the worst case if not set
+    SetTransferPlan plan{};            /// sizes of the transfers of the batch
+
+    inline void init(size_t size)
+    {
+        inputs.resize(size);
+        pairs.resize(size);
+        positions.resize(size);
+        outputs.resize(size);
+        cigars.resize(size);
+        cigar_bounds.resize(size);
+        samples.resize(size);
+    }
+
+    void send(Rank<AppPair> &rank)
+    {
+        dpu_set_t dpu{};
+        uint32_t each_dpu = 0;
+
+        DPU_FOREACH(rank.get(), dpu, each_dpu)
+        {
+            DPU_ASSERT(dpu_prepare_xfer(dpu, inputs[each_dpu].sequences.data()));
+        }
+        DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_TO_DPU, "sequences", 0,
+                                 plan.sequences, DPU_XFER_ASYNC));
+
+        DPU_FOREACH(rank.get(), dpu, each_dpu)
+        {
+            DPU_ASSERT(dpu_prepare_xfer(dpu, &inputs[each_dpu].metadata));
+        }
+        DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_TO_DPU, "metadata", 0,
+                                 sizeof(NwMetadataDPU), DPU_XFER_ASYNC));
+
+        DPU_FOREACH(rank.get(), dpu, each_dpu)
+        {
+            DPU_ASSERT(dpu_prepare_xfer(dpu, pairs[each_dpu].data()));
+        }
+        DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_TO_DPU, "pairs", 0,
+                                 plan.pairs, DPU_XFER_ASYNC));
+
+        if (transfers != nullptr)
+        {
+            transfers->to_dpu += plan.to_dpu() * inputs.size();
+            transfers->from_dpu += plan.from_dpu() * inputs.size();
+            transfers->batches++;
+        }
+    }
+
+    void gather(Rank<AppPair> &rank)
+    {
+        gather_cigar_outputs(rank.get(), outputs, cigars, plan);
+    }
+
+    void post(Rank<AppPair> &rank)
+    {
+        DPU_ASSERT(dpu_callback(rank.get(), rank_postprocess, this, DPU_CALLBACK_ASYNC));
+    }
+
+    static dpu_error_t rank_postprocess(dpu_set_t rank_set, [[maybe_unused]] uint32_t id, void *_arg)
+    {
+        auto &rank = *static_cast<AppPair *>(_arg);
+        const auto size = rank.inputs.size();
+        auto batch = std::move(rank.batch);
+        auto &arena = batch->cigars;
+
+        fetch_cigars_left(rank_set, rank.outputs, rank.cigars, rank.plan, rank.transfers);
+        if (rank.cigar_budget != nullptr)
+            rank.cigar_budget->observe(rank.cigar_bounds, rank.outputs);
+
+        for (size_t i = 0; i < size; i++)
+        {
+            const auto &output = rank.outputs[i];
+            size_t n_runs = 0;
+            for (size_t k = 0; k < rank.positions[i].size(); k++)
+                n_runs += output.lengths[k];
+            auto runs = arena.allocate(n_runs);
+
+            for (size_t k = 0; k < rank.positions[i].size(); k++)
+            {
+                const uint32_t length = output.lengths[k];
+                const auto *traceback = &rank.cigars[i][output.offsets[k]];
+
+                // runs are written by the traceback from the end of the alignment
+                std::reverse_copy(traceback, traceback + length, arena.data(runs));
+                batch->results[rank.positions[i][k]] = {output.scores[k], {runs, length}};
+                runs += length;
+            }
+
+            rank.samples[i].cycles = static_cast<double>(output.perf_counter);
+        }
+
+        if (rank.cost_model != nullptr)
+            rank.cost_model->observe(rank.samples);
+
+        // the batch is freed by the writer once serialized
+        rank.writer->write({{rank.chunk, batch->results}}, arena, [batch]() {});
+
+        return DPU_OK;
+    }
+
+    /**
+     * @brief Splits the pairs of a batch between the dpus and packs their inputs. Pairs are sorted by sequence, then cut
+     * in runs of about the same cost, a run ending early when its dpu has no room left for the next pair.
+     *
+     * @param store
+     * @param list pairs of the batch
+     * @param cost
+     * @param p
+     * @return false if the pairs do not fit the dpus of the rank
+     */
+    bool pack(const SequenceStore &store, std::span<const SequencePair> list, const CostModel::Coefficients &cost, const NwParameters &p)
+    {
+        const auto n_dpu = inputs.size();
+
+        auto pair_cost = [&](const SequencePair &pair)
+        {
+            return cost(static_cast<double>(store.length(pair.first) + store.length(pair.second) - 1), 1);
+        };
+
+        std::vector<uint32_t> order(list.size());
+        std::iota(order.begin(), order.end(), 0U);
+        std::ranges::sort(order, [&](uint32_t a, uint32_t b)
+                          { return std::pair{list[a].first, list[a].second} < std::pair{list[b].first, list[b].second}; });
+
+        double total = 0;
+        for (const auto &pair : list)
+            total += pair_cost(pair);
+
+        size_t d = 0;
+        double load = 0;                             // cost given to the dpus up to d
+        DpuUsage usage{};                            // buffers used on dpu d
+        std::unordered_map<uint32_t, uint16_t> sent; // sequences of dpu d, index on the dpu
+
+        auto reset = [&](size_t i)
+        {
+            auto &input = inputs[i];
+            input.metadata = {};
+            input.metadata.match = p.match;
+            input.metadata.mismatch = p.mismatch;
+            input.metadata.gap_opening = p.gap_opening;
+            input.metadata.gap_extension = p.gap_extension;
+            input.sequences.clear();
+            pairs[i].clear();
+            cigar_bounds[i] = 0;
+            positions[i].clear();
+            samples[i] = {};
+        };
+        reset(0);
+
+        // room taken by a pair on dpu d, its sequences already there are not sent again
+        auto room = [&](const SequencePair &pair)
+        {
+            DpuUsage more{0, 0, 0, 1, cigar_bound(store.length(pair.first), store.length(pair.second))};
+            auto add = [&](uint32_t s)
+            {
+                if (sent.contains(s))
+                    return;
+                more.sequences++;
+                more.bytes += compressed_size(store.length(s));
+            };
+            add(pair.first);
+            if (pair.second != pair.first)
+                add(pair.second);
+            return more;
+        };
+
+        for (const auto k : order)
+        {
+            const auto &pair = list[k];
+            const auto c = pair_cost(pair);
+            auto more = room(pair);
+
+            const auto share = total * static_cast<double>(d + 1) / static_cast<double>(n_dpu);
+            if (!(usage + more).fits() || (load >= share && !positions[d].empty() && d + 1 < n_dpu))
+            {
+                if (++d == n_dpu)
+                    return false;
+                reset(d);
+                usage = {};
+                sent.clear();
+                more = room(pair);
+            }
+
+            auto &input = inputs[d];
+            auto &meta = input.metadata;
+            auto local = [&](uint32_t s)
+            {
+                auto [it, added] = sent.try_emplace(s, static_cast<uint16_t>(sent.size()));
+                if (added)
+                {
+                    const auto packed = store.packed(s);
+                    meta.indexes[it->second] = static_cast<uint32_t>(input.sequences.size());
+                    meta.lengths[it->second] = static_cast<uint16_t>(store.length(s));
+                    input.sequences.insert(input.sequences.end(), packed.begin(), packed.end());
+                }
+                return it->second;
+            };
+
+            cigar_bounds[d] += more.cigars;
+            pairs[d].push_back({local(pair.first), local(pair.second)});
+            positions[d].push_back(k);
+            samples[d].diagonals += static_cast<double>(store.length(pair.first) + store.length(pair.second) - 1);
+            samples[d].pairs++;
+            usage = usage + more;
+            load += c;
+        }
+
+        for (size_t i = d + 1; i < n_dpu; i++)
+            reset(i);
+
+        plan_transfers();
+        return true;
+    }
+
+    /**
+     * @brief Takes the next pairs of the list for the batch and packs them, each dpu is given a batch worth of cycles,
+     * or its share of the whole list if smaller so that a short list still keeps all the dpus busy.
+     * The target does not depend on the pairs left: the last batch is the only shorter one.
+     *
+     * @param store
+     * @param list all the pairs
+     * @param next first pair not yet aligned, updated
+     * @param share work of the whole list divided by the number of dpus of all the ranks
+     * @param p
+     */
+    void get_batch(const SequenceStore &store, std::span<const SequencePair> list, size_t &next, const CostSample &share, const NwParameters &p)
+    {
+        const auto n_dpu = inputs.size();
+        const auto cost = cost_model != nullptr ? cost_model->coefficients() : CostModel::cigar_prior;
+        const auto max_load = std::min(cost(AppSet::batch_diagonals, 0), cost(share.diagonals, share.pairs)) * static_cast<double>(n_dpu);
+        const auto max_pairs = n_dpu * METADATA_MAX_NUMBER_OF_SCORES;
+
+        size_t n = 0;
+        double load = 0;
+        while (next + n < list.size() && load < max_load && n < max_pairs)
+        {
+            const auto &pair = list[next + n++];
+            load += cost(static_cast<double>(store.length(pair.first) + store.length(pair.second) - 1), 1);
+        }
+
+        // sequences may not fit, the batch is shortened until they do
+        while (!pack(store, list.subspan(next, n), cost, p))
+        {
+            if (n == 1)
+                exit("Pair " + std::to_string(next) + " does not fit in a dpu");
+            n -= std::max(size_t{1}, n / 4);
+        }
+
+        size_t cigar_bytes = 0;
+        for (const auto bound : cigar_bounds)
+            cigar_bytes += bound;
+        batch = std::make_shared<SetAlignments>(SetAlignments{std::vector<NwType>(n), CigarArena(cigar_bytes)});
+        next += n;
+    }
+
+    /**
+     * @brief Sizes the transfers of the batch on the dpu using the most of each symbol,
+     * buffers are padded to that size since all the dpus of a rank receive the same number of bytes.
+     * The metadata tells the dpus the number of pairs of their list.
+     *
+     */
+    void plan_transfers()
+    {
+        size_t sequences = 0;
+        size_t n_pairs = 1;
+        size_t cigar_bytes = 0;
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            sequences = std::max(sequences, inputs[i].sequences.size());
+            n_pairs = std::max(n_pairs, positions[i].size());
+            cigar_bytes = std::max(cigar_bytes, cigar_budget != nullptr ? cigar_budget->predict(cigar_bounds[i]) : cigar_bounds[i]);
+            inputs[i].metadata.number_of_pairs = static_cast<uint32_t>(positions[i].size());
+        }
+
+        plan.sequences = round_up8(std::max(sequences, size_t{8}));
+        plan.pairs = round_up8(n_pairs * sizeof(NwPair));
+        plan.scores = round_up8(offsetof(NwCigarOutput, scores) + n_pairs * sizeof(int32_t));
+        plan.lengths = round_up8(n_pairs * sizeof(uint16_t));
+        plan.offsets = round_up8(n_pairs * sizeof(uint32_t));
+        plan.cigars = cigar_bytes;
+
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            inputs[i].sequences.resize(plan.sequences);
+            pairs[i].resize(plan.pairs / sizeof(NwPair));
+        }
+    }
+};
+
+#endif /* FD18857D_2B30_48D7_A18A_3993E4079FF9 */
@@ -2,29 +2,286 @@
 #define B264D0F9_04DC_4735_A7FD_3F0F386D53EE
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
 #include <span>
 
+#include "CostModel.hpp"
 #include "dpu_common.hpp"
 #include "Rank.hpp"
+#include "../../src/cigar_arena.hpp"
+#include "../../src/representative.hpp"
+#include "../../src/result_writer.hpp"
+#include "../../src/thread_pool.hpp"
+
+/// @brief Sets with more sequences are split in blocks of at most this many sequences, aligned block pair by block pair.
+/// Blocks of long sequences are split further until they fit a dpu (see push_block)
+constexpr size_t SET_BLOCK_SIZE = 32;
+
+/// @brief Members of a set in star mode are split in blocks of at most this many sequences, about the pairs of a full set block
+constexpr size_t STAR_BLOCK_SIZE = 512;
+
+/**
+ * @brief Dpu buffers used by blocks of pairs, each one bounded in cdefs.h
+ *
+ */
+struct DpuUsage
+{
+    size_t blocks{};    /// blocks of the metadata
+    size_t sequences{}; /// sequences of the metadata
+    size_t bytes{};     /// packed sequences
+    size_t pairs{};     /// scores, cigar lengths and cigar offsets
+    size_t cigars{};    /// cigars in the worst case, in bytes
+
+    DpuUsage operator+(const DpuUsage &o) const
+    {
+        return {blocks + o.blocks, sequences + o.sequences, bytes + o.bytes, pairs + o.pairs, cigars + o.cigars};
+    }
 
+    /// @brief Returns true if a dpu can hold it
+    bool fits() const
+    {
+        return blocks <= SCORE_METADATA_MAX_NUMBER_OF_SET &&
+               sequences <= DPU_MAX_NUMBER_OF_SEQUENCES &&
+               bytes < SCORE_MAX_SEQUENCES_TOTAL_SIZE &&
+               pairs <= METADATA_MAX_NUMBER_OF_SCORES &&
+               cigars < MAX_CIGAR_SIZE;
+    }
+};
+
+/**
+ * @brief Bytes of the run-length encoded cigar of two sequences in the worst case, 8 bytes aligned as stored by the dpu.
+ * A run holds at least one operation. The runs of gaps in the longer sequence are separated by other runs, at most one
+ * per base of the shorter one, and split every CIGAR_RUN_MAX operations: with a <= b, a + min(b, a + 1 + b / CIGAR_RUN_MAX) runs.
+ *
+ * @param l1 length of the first sequence
+ * @param l2 length of the second sequence
+ * @return size_t
+ */
+inline size_t cigar_bound(size_t l1, size_t l2)
+{
+    const auto a = std::min(l1, l2);
+    const auto b = std::max(l1, l2);
+    return round_up8(a + std::min(b, a + 1 + b / CIGAR_RUN_MAX));
+}
+
+/**
+ * @brief Pairs of a set aligned together on a dpu: all the pairs of the set, or for the sets bigger than
+ * SET_BLOCK_SIZE the pairs of a block of its sequences with itself or with a following block.
+ * In star mode, the pairs of the representative of the set (its single row) with a block of its members.
+ *
+ */
 struct SortedMap
 {
-    size_t index{};
-    size_t load{};
-    size_t dpu{};
-    size_t offset{};
+    size_t index{};       /// set
+    size_t load{};        /// anti-diagonals to compute
+    size_t pairs{};       /// number of alignments
+    size_t dpu{};         /// dpu of the batch the pairs are given to
+    size_t offset{};      /// results of the set in the window
+    uint32_t set_size{};  /// number of sequences of the set
+    uint32_t rows{};      /// first sequence of the rows in the set
+    uint32_t row_count{}; /// number of rows
+    uint32_t cols{};      /// first sequence of the columns in the set, equal to rows for a block with itself
+    uint32_t col_count{}; /// number of columns
+    DpuUsage usage{};     /// dpu buffers used, sequences shared with other blocks are counted by each of them
+    bool star{};          /// pairs of the representative, results are placed by member instead of by pair of the set
+
+    /// @brief Returns true for the distinct pairs of a block with itself
+    bool triangle() const { return rows == cols && row_count == col_count; }
+
+    /// @brief Returns true if the rows are sent among the columns
+    bool rows_in_cols() const { return rows >= cols && rows + row_count <= cols + col_count; }
+
+    /// @brief Calls f(row, col) for each pair of the block in the order the dpu aligns them, a sequence is not aligned with itself
+    template <class F>
+    void for_each_pair(F &&f) const
+    {
+        for (uint32_t r = 0; r < row_count; r++)
+            for (uint32_t c = triangle() ? r + 1 : 0; c < col_count; c++)
+                if (rows + r != cols + c)
+                    f(r, c);
+    }
+
+    /// @brief Position of the result of a pair in the results of the set
+    size_t result_index(uint32_t r, uint32_t c) const
+    {
+        const size_t i = rows + r;
+        const size_t j = cols + c;
+        if (star)
+            return star_index(i, j);
+        return triangular_index(i, j, size_t{set_size});
+    }
 };
 
-inline auto sorted_map(const Sets &data)
+/// @brief Number of results of a set, k - 1 in star mode
+inline size_t set_results(const SequenceStore &data, size_t s, bool star)
+{
+    return star ? std::max(data.set_size(s), size_t{1}) - 1 : count_unique_pair(data, s);
+}
+
+/// @brief Cycles estimate of a block of pairs
+inline double set_cost(const CostModel::Coefficients &cost, const SortedMap &sm)
+{
+    return cost(static_cast<double>(sm.load), static_cast<double>(sm.pairs));
+}
+
+/**
+ * @brief Dpu buffers used by a block of pairs, as packed by AppSet::cpu_to_dpu
+ *
+ */
+inline DpuUsage block_usage(const SequenceStore &data, const SortedMap &sm)
+{
+    if (sm.pairs == 0)
+        return {};
+
+    const auto begin = data.set_begin(sm.index);
+
+    DpuUsage usage{1, sm.col_count, data.packed_range(begin + sm.cols, begin + sm.cols + sm.col_count).size(), sm.pairs, 0};
+    if (!sm.rows_in_cols())
+    {
+        usage.sequences += sm.row_count;
+        usage.bytes += data.packed_range(begin + sm.rows, begin + sm.rows + sm.row_count).size();
+    }
+
+    sm.for_each_pair([&](uint32_t r, uint32_t c)
+                     { usage.cigars += cigar_bound(data.length(begin + sm.rows + r), data.length(begin + sm.cols + c)); });
+
+    return usage;
+}
+
+/**
+ * @brief Appends a block of pairs to the index, its pairs, load and usage computed from its rows and columns.
+ * A block whose buffers do not fit a dpu (long sequences) is split in halves until they do: a triangle in two
+ * triangles and the rectangle between them, a rectangle across its longer side.
+ *
+ * @param data
+ * @param sm block, its set, rows and columns are set
+ * @param index blocks, appended to
+ */
+inline void push_block(const SequenceStore &data, SortedMap sm, std::vector<SortedMap> &index)
+{
+    sm.load = count_compute_load(data, sm.index, sm.rows, sm.row_count, sm.cols, sm.col_count);
+    if (sm.triangle())
+        sm.pairs = sum_integers(size_t{sm.row_count});
+    else
+    {
+        // sequences both in the rows and the columns (the representative of a star) are not aligned with themselves
+        sm.pairs = size_t{sm.row_count} * sm.col_count;
+        for (auto i = std::max(sm.rows, sm.cols); i < std::min(sm.rows + sm.row_count, sm.cols + sm.col_count); i++)
+        {
+            sm.pairs--;
+            sm.load -= 2 * size_t{data.length(data.set_begin(sm.index) + i)} - 1;
+        }
+    }
+    sm.usage = block_usage(data, sm);
+
+    if (sm.usage.fits())
+    {
+        index.push_back(sm);
+        return;
+    }
+    if (sm.pairs == 1)
+        exit("A pair of sequences of set " + std::to_string(sm.index) + " does not fit in a dpu");
+
+    auto top = sm;
+    auto bottom = sm;
+    if (sm.triangle())
+    {
+        const auto h = sm.row_count / 2;
+        top.row_count = top.col_count = h;
+        bottom.rows = bottom.cols = sm.rows + h;
+        bottom.row_count = bottom.col_count = sm.row_count - h;
+
+        auto between = sm;
+        between.row_count = h;
+        between.cols = sm.rows + h;
+        between.col_count = sm.row_count - h;
+        push_block(data, between, index);
+    }
+    else if (sm.row_count >= sm.col_count)
+    {
+        top.row_count = sm.row_count / 2;
+        bottom.rows = sm.rows + top.row_count;
+        bottom.row_count = sm.row_count - top.row_count;
+    }
+    else
+    {
+        top.col_count = sm.col_count / 2;
+        bottom.cols = sm.cols + top.col_count;
+        bottom.col_count = sm.col_count - top.col_count;
+    }
+    push_block(data, top, index);
+    push_block(data, bottom, index);
+}
+
+/**
+ * @brief Star blocks of a set: its representative with each block of at most STAR_BLOCK_SIZE members
+ *
+ * @param data
+ * @param i set
+ * @param representative index of the representative in the set
+ * @param offset results of the set in the window
+ * @param index blocks, appended to
+ */
+inline void star_blocks(const SequenceStore &data, size_t i, uint32_t representative, size_t offset, std::vector<SortedMap> &index)
+{
+    const auto k = data.set_size(i);
+    const auto n_blocks = std::max(size_t{1}, (k + STAR_BLOCK_SIZE - 1) / STAR_BLOCK_SIZE);
+
+    for (size_t b = 0; b < n_blocks; b++)
+    {
+        const auto cols = static_cast<uint32_t>(b * k / n_blocks);
+        const auto col_count = static_cast<uint32_t>((b + 1) * k / n_blocks) - cols;
+
+        SortedMap sm{i, 0, 0, 0, offset, static_cast<uint32_t>(k), representative, 1, cols, col_count};
+        sm.star = true;
+        push_block(data, sm, index);
+    }
+}
+
+/**
+ * @brief Blocks of pairs of all the sets, sorted by decreasing load
+ *
+ * @param data
+ * @param representatives star mode: representative of each set, all the pairs of each set are aligned if empty
+ * @return std::vector<SortedMap>
+ */
+inline auto sorted_map(const SequenceStore &data, std::span<const uint32_t> representatives = {})
 {
-    std::vector<SortedMap> index{data.size()};
+    std::vector<SortedMap> index;
+    index.reserve(data.number_of_sets());
 
     size_t offset = 0;
-    for (size_t i = 0; i < index.size(); i++)
+    for (size_t i = 0; i < data.number_of_sets(); i++)
     {
-        index[i] = {i, count_compute_load(data[i]), 0, offset};
-        offset += sum_integers(data[i].size());
+        const auto k = data.set_size(i);
+
+        if (!representatives.empty())
+        {
+            star_blocks(data, i, representatives[i], offset, index);
+            offset += set_results(data, i, true);
+            continue;
+        }
+        const auto n_blocks = std::max(size_t{1}, (k + SET_BLOCK_SIZE - 1) / SET_BLOCK_SIZE);
+
+        // blocks of nearly the same size
+        auto block = [&](size_t b)
+        { return static_cast<uint32_t>(b * k / n_blocks); };
+
+        for (size_t r = 0; r < n_blocks; r++)
+            for (size_t c = r; c < n_blocks; c++)
+            {
+                push_block(data, {i, 0, 0, 0, offset, static_cast<uint32_t>(k), block(r), block(r + 1) - block(r), block(c), block(c + 1) - block(c)}, index);
+            }
+
+        offset += count_unique_pair(data, i);
     }
 
     std::ranges::sort(index, [](const auto &a, const auto &b)
@@ -33,48 +290,280 @@ inline auto sorted_map(const Sets &data)
     return index;
 }
 
-size_t count_compute_load(const std::span<SortedMap> &index)
+/// @brief Bytes of the CIGARs of blocks of pairs in the worst case
+inline size_t cigar_capacity(std::span<const SortedMap> index)
 {
-    size_t load = 0;
-    for (const auto &e : index)
-        load += e.load;
-    return load;
+    size_t bytes = 0;
+    for (const auto &sm : index)
+        bytes += sm.usage.cigars;
+    return bytes;
 }
 
-auto dpu_to_cpu(std::vector<std::vector<NwType>> &res, const NwInputCigar &input, const NwCigarOutput &output, size_t mi)
+/**
+ * @brief A window of consecutive sets being aligned, with its results
+ *
+ */
+struct SetWindow
 {
-    const auto &meta = input.metadata;
-    res.resize(meta.number_of_sets);
+    /// @brief Window data
+    SequenceStore sets;                /// sets of the window
+    std::vector<uint32_t> representatives; /// star mode: representative of each set, empty otherwise
+    std::vector<SortedMap> index;      /// blocks of pairs of the sets sorted by load
+    SetAlignments alignments;          /// results of all the pairs of the window
+    std::atomic<size_t> pending{0};    /// number of batches dispatched and not yet post-processed
+    std::atomic<bool> dispatched{false}; /// all sets of the window are dispatched
+    size_t first_chunk{};                /// result writer chunk of the first set
+    std::unique_ptr<std::atomic<uint32_t>[]> blocks_left; /// blocks of each set not yet post-processed
+
+    /**
+     * @brief Splits the sets in blocks of pairs
+     *
+     * @param s sets of the window
+     * @param star star mode: each member is only aligned with the representative of its set, chosen this way
+     */
+    explicit SetWindow(SequenceStore &&s, std::optional<Representative> star = std::nullopt)
+        : sets(std::move(s)), representatives(star ? choose_representatives(sets, *star) : std::vector<uint32_t>{}),
+          index(sorted_map(sets, representatives)), alignments{{}, CigarArena(cigar_capacity(index)), representatives},
+          blocks_left(new std::atomic<uint32_t>[sets.number_of_sets()]{})
+    {
+        size_t n_results = 0;
+        for (size_t i = 0; i < sets.number_of_sets(); i++)
+            n_results += set_results(sets, i, star.has_value());
+        alignments.results.resize(n_results);
+
+        for (const auto &sm : index)
+            blocks_left[sm.index]++;
+    }
 
-    auto comb = [](auto n)
-    { return n * (n - 1) / 2; };
+    /// @brief Returns true once all results of the window are available
+    bool done() const { return dispatched && pending == 0; }
+};
 
-    int dpu_offset = 0;
+/**
+ * @brief Notified each time a batch is done, the dispatcher waits on it for the windows to drain
+ *
+ */
+class BatchSignal
+{
+    std::mutex mutex{};
+    std::condition_variable cv{};
 
-    for (size_t set_id = 0; set_id < meta.number_of_sets; set_id++)
+public:
+    /// @brief Wakes the waiters, to call once the batch state they check has been updated
+    void notify()
     {
-        int set_offset = 0;
-        res[set_id].resize(comb(meta.set_sizes[set_id]));
-        for (int i = 0; i < meta.set_sizes[set_id]; i++)
-            for (int j = i + 1; j < meta.set_sizes[set_id]; j++)
-            {
-                res[set_id][set_offset].score = output.scores[dpu_offset];
-                res[set_id][set_offset].dpu_offset = dpu_offset;
-                res[set_id][set_offset].mi = mi;
-                dpu_offset++;
-                set_offset++;
-            }
+        {
+            std::lock_guard lock(mutex);
+        }
+        cv.notify_all();
+    }
+
+    /// @brief Waits until done() returns true, it is checked again after each notification
+    template <typename P>
+    void wait(P &&done)
+    {
+        std::unique_lock lock(mutex);
+        cv.wait(lock, std::forward<P>(done));
+    }
+};
+
+/**
+ * @brief Host time spent in each stage of the set pipeline, summed over all the batches
+ *
+ */
+struct SetStageTimes
+{
+    StageTime bucket{};      /// taking the sets of a batch
+    StageTime pack{};        /// assigning the sets to dpus and packing the dpu inputs, in the background
+    StageTime wait{};        /// waiting for a staged batch to be packed once its rank is free
+    StageTime dispatch{};    /// queueing the transfers and the launch of a batch
+    StageTime postprocess{}; /// rank post-process callbacks
+
+    void Print() const
+    {
+        printf("Host stages:\n");
+        bucket.Print("bucket");
+        pack.Print("pack");
+        wait.Print("wait");
+        dispatch.Print("dispatch");
+        postprocess.Print("postprocess");
+        printf("\n");
     }
+};
+
+/**
+ * @brief Bytes to transfer per dpu for each symbol of a batch: the most used by a dpu of the rank, rounded to 8 bytes.
+ * The metadata is always sent whole, its scalars are at the end of the structure.
+ *
+ */
+struct SetTransferPlan
+{
+    size_t sequences{}; /// packed sequences
+    size_t pairs{};     /// explicit pair list, none for blocks of pairs
+    size_t scores{};    /// perf counter, cigar bytes and scores of the output
+    size_t lengths{};   /// cigar lengths of the output
+    size_t offsets{};   /// cigar offsets of the output
+    size_t cigars{};    /// cigars, as many bytes as predicted for the dpu using the most
+
+    size_t to_dpu() const { return sequences + sizeof(NwMetadataDPU) + pairs; }
+    size_t from_dpu() const { return scores + lengths + offsets + cigars; }
+};
+
+/**
+ * @brief Bytes moved between the host and the dpus by the set pipeline
+ *
+ */
+struct SetTransferStats
+{
+    std::atomic<uint64_t> to_dpu{0};   /// bytes sent
+    std::atomic<uint64_t> from_dpu{0}; /// bytes received, cigars included
+    std::atomic<uint64_t> batches{0};  /// number of batches
+    std::atomic<uint64_t> refetches{0}; /// batches with more cigars than predicted, the rest fetched by the post-process
 
-    return res;
+    void Print() const
+    {
+        const double n = batches == 0 ? 1.0 : static_cast<double>(batches);
+        printf("Transfers:\n"
+               "  to dpus:   %10.1f MB, %8.2f MB per batch\n"
+               "  from dpus: %10.1f MB, %8.2f MB per batch, %lu cigar refetches\n\n",
+               static_cast<double>(to_dpu) * 1e-6, static_cast<double>(to_dpu) * 1e-6 / n,
+               static_cast<double>(from_dpu) * 1e-6, static_cast<double>(from_dpu) * 1e-6 / n, refetches.load());
+    }
+};
+
+/**
+ * @brief Predicts the bytes of cigars used by a dpu as a share of the worst case of its pairs, learnt from the previous
+ * batches, so that the cigars are fetched in the async queue of the rank with the rest of the output. The share starts
+ * at the worst case, then follows the biggest share seen with a margin, the older batches being progressively forgotten.
+ * Thread safe.
+ *
+ */
+class CigarBudget
+{
+    static constexpr double margin = 1.25;    /// room above the share seen
+    static constexpr double forgetting = 0.9; /// decay of the share when the batches use less
+
+    double m_share{1.0};
+    mutable std::mutex m_mutex{};
+
+public:
+    /// @brief Bytes to fetch from a dpu whose cigars take at most bound bytes
+    size_t predict(size_t bound) const
+    {
+        std::lock_guard lock(m_mutex);
+        return std::min(bound, round_up8(static_cast<size_t>(m_share * static_cast<double>(bound))));
+    }
+
+    /**
+     * @brief Adds the cigars of the dpus of a batch
+     *
+     * @param bounds worst case of the cigars of each dpu
+     * @param outputs output of each dpu
+     */
+    void observe(std::span<const size_t> bounds, std::span<const NwCigarOutput> outputs)
+    {
+        double share = 0;
+        for (size_t i = 0; i < bounds.size(); i++)
+            if (bounds[i] != 0)
+                share = std::max(share, static_cast<double>(outputs[i].cigar_bytes) / static_cast<double>(bounds[i]));
+
+        std::lock_guard lock(m_mutex);
+        m_share = std::min(1.0, std::max(share * margin, m_share * forgetting));
+    }
+
+    void Print() const
+    {
+        std::lock_guard lock(m_mutex);
+        printf("Cigar budget: %.1f%% of the worst case fetched\n\n", m_share * 100);
+    }
+};
+
+/**
+ * @brief Queues the transfers of the outputs of a rank, with the cigars the dpus are predicted to use
+ *
+ * @param rank
+ * @param outputs
+ * @param cigars cigars of each dpu, resized to the prediction
+ * @param plan sizes of the transfers
+ */
+inline void gather_cigar_outputs(dpu_set_t rank, std::vector<NwCigarOutput> &outputs, std::vector<std::vector<uint8_t>> &cigars, const SetTransferPlan &plan)
+{
+    dpu_set_t dpu{};
+    uint32_t each_dpu = 0;
+
+    // the used part of the arrays of the output
+    DPU_FOREACH(rank, dpu, each_dpu)
+    {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &outputs[each_dpu]));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "output", 0,
+                             plan.scores, DPU_XFER_ASYNC));
+
+    if (plan.lengths == 0)
+        return;
+
+    DPU_FOREACH(rank, dpu, each_dpu)
+    {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, outputs[each_dpu].lengths));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "output", offsetof(NwCigarOutput, lengths),
+                             plan.lengths, DPU_XFER_ASYNC));
+
+    DPU_FOREACH(rank, dpu, each_dpu)
+    {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, outputs[each_dpu].offsets));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "output", offsetof(NwCigarOutput, offsets),
+                             plan.offsets, DPU_XFER_ASYNC));
+
+    if (plan.cigars == 0)
+        return;
+
+    DPU_FOREACH(rank, dpu, each_dpu)
+    {
+        cigars[each_dpu].resize(plan.cigars);
+        DPU_ASSERT(dpu_prepare_xfer(dpu, cigars[each_dpu].data()));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank, DPU_XFER_FROM_DPU, "cigars", 0,
+                             plan.cigars, DPU_XFER_ASYNC));
 }
 
-// Do not erase previous data in file
-void write_vector_to_file(const std::vector<NwCigarOutput> &v, const std::string &filename)
+/**
+ * @brief Fetches the cigars beyond the prediction, once a dpu of the rank used more.
+ * Called by the post-process, seldom once the prediction is learnt.
+ *
+ * @param rank_set rank given to the callback
+ * @param outputs
+ * @param cigars cigars of each dpu, the prediction already fetched
+ * @param plan sizes of the transfers
+ * @param transfers transfer counters, if set
+ */
+inline void fetch_cigars_left(dpu_set_t rank_set, const std::vector<NwCigarOutput> &outputs, std::vector<std::vector<uint8_t>> &cigars,
+                              const SetTransferPlan &plan, SetTransferStats *transfers)
 {
-    std::ofstream file(filename, std::ios_base::app);
-    for (const auto &e : v)
-        file << e.perf_counter << '\n';
+    size_t used = plan.cigars;
+    for (const auto &output : outputs)
+        used = std::max(used, size_t{output.cigar_bytes});
+
+    if (used == plan.cigars)
+        return;
+
+    dpu_set_t dpu{};
+    uint32_t each_dpu = 0;
+
+    DPU_FOREACH(rank_set, dpu, each_dpu)
+    {
+        cigars[each_dpu].resize(used);
+        DPU_ASSERT(dpu_prepare_xfer(dpu, cigars[each_dpu].data() + plan.cigars));
+    }
+    DPU_ASSERT(dpu_push_xfer(rank_set, DPU_XFER_FROM_DPU, "cigars", static_cast<uint32_t>(plan.cigars),
+                             used - plan.cigars, DPU_XFER_DEFAULT));
+
+    if (transfers != nullptr)
+    {
+        transfers->from_dpu += (used - plan.cigars) * cigars.size();
+        transfers->refetches++;
+    }
 }
 
 class AppSet
@@ -82,16 +571,31 @@ class AppSet
 public:
     std::vector<NwInputCigar> inputs{};
     std::vector<NwCigarOutput> outputs{};
-    std::vector<std::vector<char>> cigars{};
+    std::vector<std::vector<uint8_t>> cigars{};
+    std::vector<size_t> n_pairs{};      /// pairs of each dpu
+    std::vector<size_t> cigar_bounds{}; /// worst case of the cigars of each dpu, in bytes
     std::span<SortedMap> index{};
     std::span<NwType> result{};
-    size_t cigar_size{};
+    CigarArena *arena{};            /// storage of the CIGARs of the window
+    std::atomic<size_t> *pending{}; /// batches in flight of the window being processed
+    BatchSignal *batch_signal{};    /// notified once the batch is done, if set
+    std::atomic<uint32_t> *blocks_left{}; /// blocks of each set of the window not yet post-processed
+    ResultWriter *writer{};         /// writes the results of each batch once post-processed, if set
+    size_t first_chunk{};           /// writer chunk of the first set of the window
+    ThreadPool *pool{};             /// packs the dpu inputs in parallel, if set
+    SetStageTimes *times{};         /// stage timers, if set
+    SetTransferStats *transfers{};  /// transfer counters, if set
+    CostModel *cost_model{};        /// sizes and balances the batches, fitted with their perf counters, if set
+    CigarBudget *cigar_budget{};    /// predicts the cigars to fetch, the worst case if not set
+    SetTransferPlan plan{};         /// sizes of the transfers of the batch
 
     inline void init(size_t size)
     {
         inputs.resize(size);
         outputs.resize(size);
         cigars.resize(size);
+        n_pairs.resize(size);
+        cigar_bounds.resize(size);
     }
 
     void send(Rank<AppSet> &rank)
@@ -104,7 +608,7 @@ public:
             DPU_ASSERT(dpu_prepare_xfer(dpu, inputs[each_dpu].sequences.data()));
         }
         DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_TO_DPU, "sequences", 0,
-                                 SCORE_MAX_SEQUENCES_TOTAL_SIZE, DPU_XFER_ASYNC));
+                                 plan.sequences, DPU_XFER_ASYNC));
 
         DPU_FOREACH(rank.get(), dpu, each_dpu)
         {
@@ -113,34 +617,17 @@ public:
         DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_TO_DPU, "metadata", 0,
                                  sizeof(NwMetadataDPU), DPU_XFER_ASYNC));
 
-        DPU_FOREACH(rank.get(), dpu, each_dpu)
+        if (transfers != nullptr)
         {
-            DPU_ASSERT(dpu_prepare_xfer(dpu, inputs[each_dpu].cigar_indexes.data()));
+            transfers->to_dpu += plan.to_dpu() * inputs.size();
+            transfers->from_dpu += plan.from_dpu() * inputs.size();
+            transfers->batches++;
         }
-        DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_TO_DPU, "cigar_indexes", 0,
-                                 METADATA_MAX_NUMBER_OF_SCORES * sizeof(uint32_t), DPU_XFER_ASYNC));
     }
 
     void gather(Rank<AppSet> &rank)
     {
-        dpu_set_t dpu{};
-        uint32_t each_dpu = 0;
-
-        for (auto &cigar : cigars)
-            cigar.resize(cigar_size);
-
-        DPU_FOREACH(rank.get(), dpu, each_dpu)
-        {
-            DPU_ASSERT(dpu_prepare_xfer(dpu, &outputs[each_dpu]));
-        }
-        DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_FROM_DPU, "output", 0,
-                                 sizeof(NwCigarOutput), DPU_XFER_ASYNC));
-        DPU_FOREACH(rank.get(), dpu, each_dpu)
-        {
-            DPU_ASSERT(dpu_prepare_xfer(dpu, cigars[each_dpu].data()));
-        }
-        DPU_ASSERT(dpu_push_xfer(rank.get(), DPU_XFER_FROM_DPU, "cigars", 0,
-                                 cigar_size, DPU_XFER_ASYNC));
+        gather_cigar_outputs(rank.get(), outputs, cigars, plan);
     }
 
     void post(Rank<AppSet> &rank)
@@ -148,164 +635,293 @@ public:
         DPU_ASSERT(dpu_callback(rank.get(), rank_postprocess, this, DPU_CALLBACK_ASYNC));
     }
 
-    static dpu_error_t rank_postprocess([[maybe_unused]] dpu_set_t _, [[maybe_unused]] uint32_t id, void *_arg)
+    static dpu_error_t rank_postprocess(dpu_set_t rank_set, [[maybe_unused]] uint32_t id, void *_arg)
     {
         auto &rank = *static_cast<AppSet *>(_arg);
+        const Time start{CLOCK_MONOTONIC_RAW};
         const auto &inputs = rank.inputs;
         const auto &outputs = rank.outputs;
         auto &cpu_output = rank.result;
         const auto &cigars = rank.cigars;
         const auto &index = rank.index;
+        auto &arena = *rank.arena;
 
         auto size = inputs.size();
 
-        std::array<std::vector<std::vector<NwType>>, 64> dpu_res{};
+        fetch_cigars_left(rank_set, outputs, rank.cigars, rank.plan, rank.transfers);
+        if (rank.cigar_budget != nullptr)
+            rank.cigar_budget->observe(rank.cigar_bounds, outputs);
 
-        write_vector_to_file(outputs, std::string("counters/r") + std::to_string(id) + ".txt");
-
-        // #pragma omp parallel for
+        // runs of a dpu are stored contiguously in the arena
+        std::vector<uint64_t> runs(size);
         for (size_t i = 0; i < size; i++)
-            dpu_to_cpu(dpu_res[i], inputs[i], outputs[i], i);
+        {
+            size_t n_runs = 0;
+            for (size_t k = 0; k < rank.n_pairs[i]; k++)
+                n_runs += outputs[i].lengths[k];
+            runs[i] = arena.allocate(n_runs);
+        }
 
-        for (const auto &[i, load, d, off] : index)
+        // blocks of a dpu are in the same order in the index, results are placed in one pass
+        std::vector<size_t> dpu_pair(size);
+
+        std::vector<ResultWriter::Chunk> chunks;
+        chunks.reserve(index.size());
+
+        // work of each dpu, to fit the cost model with its perf counter
+        std::vector<CostSample> samples(size);
+
+        for (const auto &sm : index)
         {
-            auto &set_res = dpu_res[d].front();
-            for (size_t r = 0; r < set_res.size(); r++)
+            const auto d = sm.dpu;
+            samples[d].diagonals += static_cast<double>(sm.load);
+            samples[d].pairs += static_cast<double>(sm.pairs);
+
+            // pairs of a block are aligned row by row, placed at their index in the set
+            sm.for_each_pair([&](uint32_t a, uint32_t b)
+                             {
+                                 const auto k = dpu_pair[d]++;
+                                 const uint32_t length = outputs[d].lengths[k];
+                                 const auto *traceback = &cigars[d][outputs[d].offsets[k]];
+
+                                 // runs are written by the traceback from the end of the alignment
+                                 std::reverse_copy(traceback, traceback + length, arena.data(runs[d]));
+
+                                 cpu_output[sm.offset + sm.result_index(a, b)] = {outputs[d].scores[k], {runs[d], length}};
+                                 runs[d] += length; });
+
+            // a set is written once its last block is placed
+            if (--rank.blocks_left[sm.index] == 0)
             {
-                cpu_output[off + r] = set_res[r];
-                cpu_output[off + r].cigar.resize(outputs[set_res[r].mi].lengths[set_res[r].dpu_offset]);
-                cpu_output[off + r].cigar.assign(&cigars[set_res[r].mi][inputs[set_res[r].mi].cigar_indexes[set_res[r].dpu_offset]], outputs[set_res[r].mi].lengths[set_res[r].dpu_offset]);
+                const auto n = sm.star ? sm.set_size - 1U : sum_integers(size_t{sm.set_size});
+                chunks.emplace_back(rank.first_chunk + sm.index, cpu_output.subspan(sm.offset, n));
             }
-            dpu_res[d].erase(dpu_res[d].begin());
         }
 
+        if (rank.cost_model != nullptr)
+        {
+            for (size_t i = 0; i < size; i++)
+                samples[i].cycles = static_cast<double>(outputs[i].perf_counter);
+            rank.cost_model->observe(samples);
+        }
+
+        // the batch is done once its results are serialized
+        auto *pending = rank.pending;
+        auto *signal = rank.batch_signal;
+        auto batch_done = [pending, signal]
+        {
+            if (pending != nullptr)
+                (*pending)--;
+            if (signal != nullptr)
+                signal->notify();
+        };
+
+        if (rank.writer != nullptr)
+            rank.writer->write(std::move(chunks), arena, batch_done);
+        else
+            batch_done();
+
+        if (rank.times != nullptr)
+            rank.times->postprocess.add(start);
+
         return DPU_OK;
     }
 
-    static auto take_load(std::span<SortedMap> &sp, size_t n_dpu, size_t n_set, size_t &total_set)
+    /// @brief Dpu work of a full batch, as many cycles as this number of anti-diagonals: amortizes the launch and the transfers
+    static constexpr double batch_diagonals = 12800000;
+
+    /**
+     * @brief Takes the blocks of the next batch from the front of sp and gives them to the dpus. Blocks come sorted
+     * by decreasing load and each one goes to the least loaded dpu with room for it in all its buffers, the lowest
+     * index on ties. Blocks fitting no dpu are left for the next batches, the batch ends once the rank is given
+     * max_load cycles or once n_dpu blocks were left.
+     *
+     * @param sp blocks left, sorted by decreasing load
+     * @param n_dpu number of dpus of the rank
+     * @param max_load cycles of work for the rank
+     * @param total_set number of blocks left, updated
+     * @param cost
+     * @return blocks of the batch, their dpu is set
+     */
+    static auto take_load(std::span<SortedMap> &sp, size_t n_dpu, double max_load, size_t &total_set, const CostModel::Coefficients &cost)
     {
         if (n_dpu == 0)
             exit("Rank size is 0 !\n");
 
-        int i = 0;
-
-        constexpr size_t threshold = 12800000;
-        size_t rank_load = 0;
-        size_t max_load = std::max(threshold, sp[0].load - (sp[0].load / 8)) * n_dpu;
-        constexpr size_t min_load = 1280000;
-
-        n_set = std::min(SCORE_METADATA_MAX_NUMBER_OF_SET * n_dpu, n_set);
-
-        // printf("%lu/%lu\n", n_set, total_set);
-
-        for (const auto &sm : sp)
+        // min-heap of the dpus by load then index
+        using DpuLoad = std::pair<double, size_t>;
+        std::vector<DpuLoad> heap;
+        heap.reserve(n_dpu);
+        for (size_t d = 0; d < n_dpu; d++)
+            heap.push_back({0, d});
+        std::priority_queue<DpuLoad, std::vector<DpuLoad>, std::greater<>> dpu_loads(std::greater<>{}, std::move(heap));
+
+        std::vector<DpuUsage> dpu_usage(n_dpu);
+        std::vector<DpuLoad> skipped;
+        double rank_load = 0;
+        size_t taken = 0;
+        size_t left = 0;
+        size_t k = 0;
+
+        for (; k < sp.size(); k++)
         {
-            if ((rank_load >= max_load && i >= static_cast<int>(n_dpu)) ||
-                (i > static_cast<int>(SCORE_METADATA_MAX_NUMBER_OF_SET * n_dpu)) ||
-                (i > static_cast<int>(n_set) && rank_load > min_load))
+            if ((rank_load >= max_load && taken >= n_dpu) || left >= n_dpu)
                 break;
 
-            rank_load += sm.load;
-            i++;
-        }
-
-        if (i > static_cast<int>(n_dpu))
-            i = i - static_cast<int>(i % n_dpu);
+            // least loaded dpus first, the full ones are put back once the block is placed
+            auto &sm = sp[k];
+            sm.dpu = n_dpu;
+            skipped.clear();
+            while (!dpu_loads.empty())
+            {
+                const auto [load, d] = dpu_loads.top();
+                dpu_loads.pop();
+                if (!(dpu_usage[d] + sm.usage).fits())
+                {
+                    skipped.push_back({load, d});
+                    continue;
+                }
 
-        auto b = sp.begin();
+                const auto c = set_cost(cost, sm);
+                sm.dpu = d;
+                dpu_usage[d] = dpu_usage[d] + sm.usage;
+                dpu_loads.push({load + c, d});
+                rank_load += c;
+                taken++;
+                break;
+            }
+            for (const auto &s : skipped)
+                dpu_loads.push(s);
 
-        total_set -= i;
+            // every block fits an empty dpu (push_block), this one waits for a next batch
+            if (sm.dpu == n_dpu)
+                left++;
+        }
 
-        // printf("sets: %d\n", i);
+        // blocks taken first, the ones left keep their order for the next batches
+        std::stable_partition(sp.begin(), sp.begin() + static_cast<std::ptrdiff_t>(k), [n_dpu](const auto &sm)
+                              { return sm.dpu < n_dpu; });
 
-        sp = sp.last(sp.size() - i);
+        auto batch = sp.first(taken);
+        sp = sp.subspan(taken);
+        total_set -= taken;
 
-        return std::span<SortedMap>(b, b + i);
+        return batch;
     }
 
     void get_bucket(std::span<SortedMap> &index_span, size_t &total_set, size_t n_rank)
     {
         auto n_dpu = inputs.size();
+        const auto cost = cost_model != nullptr ? cost_model->coefficients() : CostModel::cigar_prior;
 
-        auto n_set = SCORE_METADATA_MAX_NUMBER_OF_SET * n_dpu;
+        // the dpus run the target time of a batch, or as long as the biggest block left
+        auto max_load = std::max(cost(batch_diagonals, 0), set_cost(cost, index_span[0])) * static_cast<double>(n_dpu);
 
-        if (total_set < n_set * n_rank)
-            n_set = std::max(n_dpu, total_set / n_rank);
+        if (total_set < SCORE_METADATA_MAX_NUMBER_OF_SET * n_dpu * n_rank)
+        {
+            // last batches: the work left is shared evenly so that the ranks finish together
+            double left = 0;
+            for (const auto &sm : index_span)
+                left += set_cost(cost, sm);
+            max_load = std::min(max_load, left / static_cast<double>(n_rank));
+        }
 
-        index = take_load(index_span, n_dpu, n_set, total_set);
+        index = take_load(index_span, n_dpu, max_load, total_set, cost);
     }
 
-    static auto cpu_to_dpu(const Sets &sets, NwInputCigar &dpu_input)
+    /**
+     * @brief Packs the blocks of pairs of a dpu into its input, only the sequences of the blocks are sent
+     *
+     * @param store
+     * @param index blocks of the batch
+     * @param blocks blocks of the dpu, positions in index
+     * @param dpu_input
+     * @return size_t number of pairs to align
+     */
+    static auto cpu_to_dpu(const SequenceStore &store, std::span<const SortedMap> index, const std::vector<size_t> &blocks, NwInputCigar &dpu_input)
     {
-        assert(sets.size() <= SCORE_METADATA_MAX_NUMBER_OF_SET &&
-               "Too many sets for DPU!\n");
-
         auto &meta = dpu_input.metadata;
-        meta.number_of_sets = static_cast<uint32_t>(sets.size());
 
         uint32_t idx = 0;
-        uint32_t seq_idx = 0;
-        uint32_t cigar_index = 0;
-        uint32_t cigar_offset = 0;
+        uint16_t seq_idx = 0;
+        uint32_t n_blocks = 0;
+        size_t n_pairs = 0;
 
-        for (size_t set_id = 0; set_id < sets.size(); set_id++)
-            meta.set_sizes[set_id] = static_cast<uint8_t>(sets[set_id].size());
+        // sequence ranges already sent: first sequence in the store, count, first sequence on the dpu
+        std::vector<std::array<size_t, 3>> sent;
 
-        for (const auto &set : sets)
+        // sequences of a range are contiguous in the store, copied in one go
+        auto send = [&](size_t first, size_t count)
         {
-            for (const auto &seq : set)
+            for (const auto &[f, c, at] : sent)
+                if (f == first && c == count)
+                    return static_cast<uint16_t>(at);
+
+            sent.push_back({first, count, seq_idx});
+
+            auto packed = store.packed_range(first, first + count);
+            dpu_input.sequences.insert(dpu_input.sequences.end(), packed.begin(), packed.end());
+
+            for (size_t q = first; q < first + count; q++)
             {
-                auto csize = compressed_emplace(dpu_input.sequences, seq);
-                meta.lengths[seq_idx] = static_cast<uint16_t>(seq.size());
-                meta.indexes[seq_idx++] = idx;
-                idx += csize;
+                meta.lengths[seq_idx] = static_cast<uint16_t>(store.length(q));
+                meta.indexes[seq_idx++] = idx + static_cast<uint32_t>(store.offsets[q] - store.offsets[first]);
             }
+            idx += static_cast<uint32_t>(packed.size());
+
+            assert(seq_idx <= DPU_MAX_NUMBER_OF_SEQUENCES && "too many sequences for dpu!\n");
             assert(dpu_input.sequences.size() < SCORE_MAX_SEQUENCES_TOTAL_SIZE &&
                    "dpu sequence buffer overflow!\n");
 
-            for (size_t i = 0; i < set.size() - 1; i++)
-                for (size_t j = i + 1; j < set.size(); j++)
-                {
-                    dpu_input.cigar_indexes[cigar_offset] = cigar_index;
-                    cigar_offset++;
-                    auto max_cigar_size = set[i].size() + set[j].size();
-
-                    assert(set[i].size() + set[j].size() < UINT16_MAX && "cigar is to big for uint16_t\n");
-
-                    max_cigar_size += (8 - (max_cigar_size % 8));
-                    cigar_index += max_cigar_size;
+            return static_cast<uint16_t>(sent.back()[2]);
+        };
 
-                    assert(cigar_index < MAX_CIGAR_SIZE && "not enough space for cigar on dpu!\n");
-                    assert(cigar_offset <= METADATA_MAX_NUMBER_OF_SCORES && "too much cigar to compute!\n");
-                }
+        for (const auto b : blocks)
+        {
+            const auto &sm = index[b];
+            if (sm.pairs == 0)
+                continue;
+
+            assert(n_blocks < SCORE_METADATA_MAX_NUMBER_OF_SET && "Too many blocks for DPU!\n");
+
+            // rows among the columns (a block with itself, a representative with its block) are sent once
+            const auto begin = store.set_begin(sm.index);
+            const auto inside = sm.rows_in_cols();
+            const auto rows = inside ? uint16_t{} : send(begin + sm.rows, sm.row_count);
+            const auto cols = send(begin + sm.cols, sm.col_count);
+            meta.blocks[n_blocks++] = {inside ? static_cast<uint16_t>(cols + sm.rows - sm.cols) : rows, static_cast<uint16_t>(sm.row_count),
+                                       cols, static_cast<uint16_t>(sm.col_count)};
+
+            n_pairs += sm.pairs;
+            assert(n_pairs <= METADATA_MAX_NUMBER_OF_SCORES && "too much cigar to compute!\n");
         }
 
-        return size_t{cigar_index};
+        meta.number_of_blocks = n_blocks;
+
+        return n_pairs;
     }
 
-    static auto bucket_sets(const Sets &data, auto &index, size_t n)
+    /**
+     * @brief Blocks of each dpu, in the order of the batch
+     *
+     * @param index blocks of the batch, assigned to their dpu by take_load
+     * @param n number of dpus
+     * @return blocks of each dpu, positions in index
+     */
+    static auto bucket_sets(const auto &index, size_t n)
     {
-        std::vector<Sets> dpu_sets(n);
-        std::vector<size_t> dpu_loads(n);
-
-        for (auto &[i, load, d, off] : index)
-        {
-            auto min_index = std::distance(dpu_loads.begin(), std::ranges::min_element(dpu_loads));
-            dpu_sets[min_index].push_back(data[i]);
-            dpu_loads[min_index] += load;
-            d = min_index;
-        }
-
+        std::vector<std::vector<size_t>> dpu_sets(n);
+        for (size_t b = 0; b < index.size(); b++)
+            dpu_sets[index[b].dpu].push_back(b);
         return dpu_sets;
     }
 
-    void to_dpu_format(const Sets &data, const NwParameters &p)
+    void to_dpu_format(const SequenceStore &data, const NwParameters &p)
     {
-        auto dpu_sets = bucket_sets(data, index, inputs.size());
+        auto dpu_sets = bucket_sets(index, inputs.size());
 
-        cigar_size = 0;
-
-        for (size_t i = 0; i < inputs.size(); i++)
+        // dpu inputs are independent
+        auto pack = [&](size_t i)
         {
             inputs[i].metadata.match = p.match;
             inputs[i].metadata.mismatch = p.mismatch;
@@ -313,10 +929,50 @@ public:
             inputs[i].metadata.gap_extension = p.gap_extension;
             inputs[i].sequences.resize(0);
             inputs[i].sequences.reserve(SCORE_MAX_SEQUENCES_TOTAL_SIZE);
-            inputs[i].cigar_indexes.resize(METADATA_MAX_NUMBER_OF_SCORES);
 
-            cigar_size = std::max(cpu_to_dpu(dpu_sets[i], inputs[i]), cigar_size);
+            n_pairs[i] = cpu_to_dpu(data, index, dpu_sets[i], inputs[i]);
+
+            // the dpu stores the cigars one after the other, their worst case was counted by take_load
+            cigar_bounds[i] = 0;
+            for (const auto b : dpu_sets[i])
+                cigar_bounds[i] += index[b].usage.cigars;
+        };
+
+        if (pool != nullptr)
+            pool->parallel_for(inputs.size(), pack);
+        else
+            for (size_t i = 0; i < inputs.size(); i++)
+                pack(i);
+
+        plan_transfers();
+    }
+
+    /**
+     * @brief Sizes the transfers of the batch on the dpu using the most of each symbol,
+     * sequence buffers are padded to that size since all the dpus of a rank receive the same number of bytes.
+     *
+     */
+    void plan_transfers()
+    {
+        // no pairs (a rank without dpus, or a batch of empty blocks) only transfers the perf counters
+        size_t sequences = 0;
+        size_t pairs = 0;
+        size_t cigar_bytes = 0;
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            sequences = std::max(sequences, inputs[i].sequences.size());
+            pairs = std::max(pairs, n_pairs[i]);
+            cigar_bytes = std::max(cigar_bytes, cigar_budget != nullptr ? cigar_budget->predict(cigar_bounds[i]) : cigar_bounds[i]);
         }
+
+        plan.sequences = round_up8(std::max(sequences, size_t{8}));
+        plan.scores = round_up8(offsetof(NwCigarOutput, scores) + pairs * sizeof(int32_t));
+        plan.lengths = round_up8(pairs * sizeof(uint16_t));
+        plan.offsets = round_up8(pairs * sizeof(uint32_t));
+        plan.cigars = cigar_bytes;
+
+        for (auto &input : inputs)
+            input.sequences.resize(plan.sequences);
     }
 };
 
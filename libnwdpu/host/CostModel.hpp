@@ -0,0 +1,139 @@
+#ifndef BE6BC5FE_56CF_4133_BF21_A753FDD560CA
+#define BE6BC5FE_56CF_4133_BF21_A753FDD560CA
+
+#include <cstdio>
+#include <mutex>
+#include <span>
+
+#include "../../cdefs.h"
+
+/**
+ * @brief Work run by a dpu during a batch, with the cycles it took
+ *
+ */
+struct CostSample
+{
+    double diagonals{}; /// anti-diagonals of the banded alignments, sum of l_i + l_j - 1 over the pairs
+    double pairs{};     /// number of alignments
+    double cycles{};    /// perf counter of the dpu
+};
+
+/**
+ * @brief Estimates the cycles a dpu takes to align sets of sequences.
+ * The band has a fixed width, so the cost of an alignment is linear in its number of anti-diagonals
+ * (the traceback too is linear in the lengths), plus a fixed cost per pair for its setup and the copy of its cigar:
+ *
+ *   cycles = per_diagonal * diagonals + per_pair * pairs
+ *
+ * Coefficients start from a prior of the kernel and are fitted by least squares on the perf counters returned
+ * by the dpus after each batch, older batches being progressively forgotten. Thread safe.
+ *
+ */
+class CostModel
+{
+public:
+    struct Coefficients
+    {
+        double per_diagonal{}; /// cycles per anti-diagonal of W_MAX cells
+        double per_pair{};     /// cycles per alignment
+
+        double operator()(double diagonals, double pairs) const { return per_diagonal * diagonals + per_pair * pairs; }
+    };
+
+    /// @brief Rough prior of the cigar kernel, about 8 cycles per cell of the band
+    static constexpr Coefficients cigar_prior{W_MAX * 8.0, W_MAX * 8.0 * 16.0};
+
+private:
+    static constexpr double forgetting = 0.9; /// weight of the past samples when a batch is added
+
+    Coefficients m_prior;
+    Coefficients m_fit;
+    size_t m_batches{};
+
+    // weighted sums of the normal equations, d: diagonals, p: pairs, y: cycles
+    double m_dd{};
+    double m_dp{};
+    double m_pp{};
+    double m_dy{};
+    double m_py{};
+
+    mutable std::mutex m_mutex{};
+
+    void fit()
+    {
+        const auto det = m_dd * m_pp - m_dp * m_dp;
+        if (det > 1e-9 * m_dd * m_pp)
+        {
+            const auto per_diagonal = (m_dy * m_pp - m_py * m_dp) / det;
+            const auto per_pair = (m_py * m_dd - m_dy * m_dp) / det;
+            if (per_diagonal > 0 && per_pair >= 0)
+            {
+                m_fit = {per_diagonal, per_pair};
+                return;
+            }
+        }
+
+        // the samples do not tell both terms apart (sets of similar shapes), the prior ratio is kept
+        const auto k = m_prior.per_pair / m_prior.per_diagonal;
+        const auto norm = m_dd + 2 * k * m_dp + k * k * m_pp;
+        if (norm <= 0)
+            return;
+
+        const auto per_diagonal = (m_dy + k * m_py) / norm;
+        if (per_diagonal > 0)
+            m_fit = {per_diagonal, k * per_diagonal};
+    }
+
+public:
+    explicit CostModel(Coefficients prior = cigar_prior) : m_prior(prior), m_fit(prior) {}
+
+    CostModel(const CostModel &) = delete;
+    CostModel &operator=(const CostModel &) = delete;
+
+    /// @brief Current estimate
+    Coefficients coefficients() const
+    {
+        std::lock_guard lock(m_mutex);
+        return m_fit;
+    }
+
+    /**
+     * @brief Adds the samples of the dpus of a batch and refits the model
+     *
+     * @param samples one per dpu, the ones without work are ignored
+     */
+    void observe(std::span<const CostSample> samples)
+    {
+        std::lock_guard lock(m_mutex);
+
+        m_dd *= forgetting;
+        m_dp *= forgetting;
+        m_pp *= forgetting;
+        m_dy *= forgetting;
+        m_py *= forgetting;
+
+        for (const auto &[d, p, y] : samples)
+        {
+            if (p == 0)
+                continue;
+            m_dd += d * d;
+            m_dp += d * p;
+            m_pp += p * p;
+            m_dy += d * y;
+            m_py += p * y;
+        }
+
+        m_batches++;
+        fit();
+    }
+
+    void Print() const
+    {
+        std::lock_guard lock(m_mutex);
+        printf("Cost model (%lu batches):\n"
+               "  %.1f cycles per diagonal, %.0f cycles per pair\n\n",
+               m_batches, m_fit.per_diagonal, m_fit.per_pair);
+    }
+};
+
+#endif /* BE6BC5FE_56CF_4133_BF21_A753FDD560CA */
@@ -5,22 +5,50 @@
 #include <numeric>
 #include <thread>
 
+#include "../../src/timer.hpp"
 #include "Rank.hpp"
 
 template <class Algo>
 class PiM
 {
     std::filesystem::path bin_path;
+    dpu_set_t m_dpus{};
     std::vector<Rank<Algo>> m_ranks;
+    ReadyQueue<Rank<Algo>> m_ready{};
+    double m_alloc_time{}; /// seconds
+    double m_load_time{};  /// seconds
 
 public:
+    /**
+     * @brief Allocates all the ranks at once then loads the binary on each of them in parallel
+     *
+     * @param filename DPU binary
+     * @param n number of ranks
+     */
     explicit PiM(const std::filesystem::path &filename, size_t n) : bin_path(filename), m_ranks(n)
     {
-#pragma omp parallel for num_threads(4)
+        Timer timer{};
+        m_dpus = alloc_ranks(filename, n);
+        const auto ranks = split_ranks(m_dpus);
+        if (ranks.size() != n)
+            exit("Allocated " + std::to_string(ranks.size()) + " ranks instead of " + std::to_string(n));
+        m_alloc_time = timer.Wall();
+
+        timer.Reset();
+#pragma omp parallel for
+        for (size_t i = 0; i < n; i++)
+            m_ranks[i].init(ranks[i], filename, &m_ready);
+        m_load_time = timer.Wall();
+
         for (auto &r : m_ranks)
-            r.init(filename);
+            m_ready.push(&r);
     }
 
+    PiM(const PiM &) = delete;
+    PiM &operator=(const PiM &) = delete;
+
+    ~PiM() { dpu_free(m_dpus); }
+
     template <typename T>
     void send_all(T &data, const std::string &symbol)
     {
@@ -28,17 +56,10 @@ public:
             r.send_all(data, symbol);
     }
 
+    /// @brief Waits for a rank to complete its batch, ranks are handed out in completion order
     Rank<Algo> &get_free_rank()
     {
-        using namespace std::chrono_literals;
-
-        while (true)
-        {
-            for (auto &r : m_ranks)
-                if (r.is_available())
-                    return r.alot();
-            std::this_thread::sleep_for(1ms);
-        }
+        return m_ready.pop().alot();
     }
 
     void sync()
@@ -47,11 +68,45 @@ public:
             dpu_sync(r.get());
     }
 
+    /// @brief Number of dpus of all the ranks
+    size_t number_of_dpus() const
+    {
+        return std::accumulate(m_ranks.begin(), m_ranks.end(), 0LU, [](size_t i, const auto &e)
+                               { return i + e.size(); });
+    }
+
     void Print()
     {
-        auto n_dpu = std::accumulate(m_ranks.begin(), m_ranks.end(), 0LU, [](size_t i, const auto &e)
-                                     { return i + e.size(); });
-        printf("PiM Accelerator with %lu ranks (%lu dpus).\n", m_ranks.size(), n_dpu);
+        auto n_dpu = number_of_dpus();
+        printf("PiM Accelerator with %lu ranks (%lu dpus).\n"
+               "  allocation: %.3f s, binary load: %.3f s\n",
+               m_ranks.size(), n_dpu, m_alloc_time, m_load_time);
+    }
+
+    /// @brief Idle time of each rank between its batches
+    std::vector<RankIdleStats> idle_stats() const
+    {
+        std::vector<RankIdleStats> stats;
+        for (const auto &r : m_ranks)
+            stats.push_back(r.idle_stats());
+        return stats;
+    }
+
+    void PrintIdleStats() const
+    {
+        RankIdleStats all{};
+
+        printf("Rank idle time between batches:\n");
+        for (size_t i = 0; i < m_ranks.size(); i++)
+        {
+            const auto &e = m_ranks[i].idle_stats();
+            printf("  rank %3lu: %5lu batches, total %.3f s, max %.3f ms\n", i, e.batches, e.total, e.max * 1e3);
+            all.batches += e.batches;
+            all.total += e.total;
+            all.max = std::max(all.max, e.max);
+        }
+        printf("  all:      %5lu batches, total %.3f s, mean %.3f ms, max %.3f ms\n\n",
+               all.batches, all.total, all.batches == 0 ? 0.0 : all.total * 1e3 / static_cast<double>(all.batches), all.max * 1e3);
     }
 };
 
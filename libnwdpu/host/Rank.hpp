@@ -1,7 +1,15 @@
 #ifndef BFFF1F0E_2A88_4908_A231_706B5C411C97
 #define BFFF1F0E_2A88_4908_A231_706B5C411C97
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <future>
+#include <mutex>
 
 #include "../../src/types.hpp"
 
@@ -10,15 +18,35 @@ extern "C"
 #include <dpu.h>
 }
 
-dpu_set_t init_rank(const std::filesystem::path &filename)
+/**
+ * @brief Allocates n ranks in a single call, the binary is loaded later rank by rank
+ *
+ * @param filename DPU binary, checked before allocating
+ * @param n
+ * @return dpu_set_t set of all the ranks, to free once done
+ */
+dpu_set_t alloc_ranks(const std::filesystem::path &filename, size_t n)
 {
-    dpu_set_t dpu{};
+    dpu_set_t dpus{};
     if (!std::filesystem::exists(filename))
         exit("File " + filename.string() + " not found.");
 
-    DPU_ASSERT(dpu_alloc_ranks(1, NULL, &dpu));
-    DPU_ASSERT(dpu_load(dpu, filename.c_str(), NULL));
-    return dpu;
+    DPU_ASSERT(dpu_alloc_ranks(static_cast<uint32_t>(n), NULL, &dpus));
+    return dpus;
+}
+
+/// @brief Rank sets of a set of ranks
+std::vector<dpu_set_t> split_ranks(dpu_set_t dpus)
+{
+    dpu_set_t rank{};
+    std::vector<dpu_set_t> ranks;
+
+    DPU_RANK_FOREACH(dpus, rank)
+    {
+        ranks.push_back(rank);
+    }
+
+    return ranks;
 }
 
 size_t rank_size(dpu_set_t rank)
@@ -41,34 +69,137 @@ std::vector<size_t> rank_sizes(dpu_set_t ranks)
     return sizes;
 }
 
+/**
+ * @brief Queue of ranks ready for a new batch, filled by the completion callbacks.
+ * The dispatcher blocks on it instead of polling the ranks.
+ *
+ */
+template <class T>
+class ReadyQueue
+{
+    std::deque<T *> m_ready{};
+    std::mutex m_mutex{};
+    std::condition_variable m_cv{};
+
+public:
+    void push(T *e)
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_ready.push_back(e);
+        }
+        m_cv.notify_one();
+    }
+
+    /// @brief Waits for a ready element, the first one pushed is returned first
+    T &pop()
+    {
+        std::unique_lock lock(m_mutex);
+        m_cv.wait(lock, [this]
+                  { return !m_ready.empty(); });
+        auto *e = m_ready.front();
+        m_ready.pop_front();
+        return *e;
+    }
+};
+
+/**
+ * @brief Time a rank waited between the end of a batch and the launch of the next one
+ *
+ */
+struct RankIdleStats
+{
+    size_t batches{}; /// number of batches launched
+    double total{};   /// total idle time in seconds
+    double max{};     /// longest idle time in seconds
+};
+
 template <class App>
 class Rank
 {
-    dpu_set_t m_rank{};
+    using clock = std::chrono::steady_clock;
+
+    dpu_set_t m_rank{}; /// owned by the set of all the ranks, freed with it
     size_t m_size{};
-    bool m_valid = false;
-    bool m_available = true;
+    std::atomic<bool> m_available = true;
+    ReadyQueue<Rank> *m_queue{};
+    clock::time_point m_freed{};
+    RankIdleStats m_idle{};
 
-public:
-    App algo{};
+    // two staging buffers: the next batch is prepared in one while the other one runs on the rank
+    std::array<App, 2> m_buffers{};
+    size_t m_active = 0;
+    std::future<void> m_staged{};
 
-    inline void init(const std::filesystem::path &filename)
+public:
+    /**
+     * @brief Loads the binary on an allocated rank and sets up its buffers
+     *
+     * @param rank
+     * @param filename DPU binary
+     * @param queue queue the rank is pushed to once free
+     */
+    inline void init(dpu_set_t rank, const std::filesystem::path &filename, ReadyQueue<Rank> *queue = nullptr)
     {
-        m_rank = init_rank(filename);
-        m_valid = true;
+        m_rank = rank;
+        DPU_ASSERT(dpu_load(m_rank, filename.c_str(), NULL));
         m_size = rank_size(m_rank);
-        algo.init(m_size);
+        m_queue = queue;
+        for (auto &b : m_buffers)
+            b.init(m_size);
+        m_freed = clock::now();
+    }
+
+    /// @brief Buffer of the batch being dispatched to or run by the rank
+    App &algo() { return m_buffers[m_active]; }
+
+    /// @brief Buffer in which the next batch is prepared, its previous batch is done once the rank is free
+    App &staging() { return m_buffers[m_active ^ 1]; }
+
+    /**
+     * @brief Prepares the next batch in the staging buffer in the background
+     *
+     * @param prepare function filling the staging buffer
+     */
+    template <typename F>
+    void stage(F &&prepare)
+    {
+        m_staged = std::async(std::launch::async, [this, prepare = std::forward<F>(prepare)]
+                              { prepare(staging()); });
+    }
+
+    /// @brief A batch is staged and not yet dispatched
+    bool has_staged() const { return m_staged.valid(); }
+
+    /// @brief Waits for the staged batch and makes it the one dispatched
+    void use_staged()
+    {
+        m_staged.get();
+        m_active ^= 1;
     }
 
     size_t size() const { return m_size; }
     bool is_available() const { return m_available; }
+    const RankIdleStats &idle_stats() const { return m_idle; }
     dpu_set_t &get() { return m_rank; }
     Rank &alot()
     {
         m_available = false;
         return *this;
     }
-    void done() { m_available = true; }
+    void done()
+    {
+        m_freed = clock::now();
+        release();
+    }
+
+    /// @brief Gives back a rank obtained from the ready queue without running a batch
+    void release()
+    {
+        m_available = true;
+        if (m_queue != nullptr)
+            m_queue->push(this);
+    }
 
     static dpu_error_t rank_done([[maybe_unused]] dpu_set_t _, [[maybe_unused]] uint32_t id, void *_arg)
     {
@@ -77,8 +208,16 @@ public:
         return DPU_OK;
     };
 
-    void launch() { DPU_ASSERT(dpu_launch(m_rank, DPU_ASYNCHRONOUS)); }
-    void send() { algo.send(*this); }
+    void launch()
+    {
+        const std::chrono::duration<double> idle = clock::now() - m_freed;
+        m_idle.batches++;
+        m_idle.total += idle.count();
+        m_idle.max = std::max(m_idle.max, idle.count());
+
+        DPU_ASSERT(dpu_launch(m_rank, DPU_ASYNCHRONOUS));
+    }
+    void send() { algo().send(*this); }
 
     template <typename T>
     void send_all(T &data, const std::string &symbol)
@@ -89,10 +228,10 @@ public:
             DPU_ASSERT(dpu_broadcast_to(m_rank, symbol.c_str(), 0, &data, sizeof(T), DPU_XFER_ASYNC));
     }
 
-    void gather() { algo.gather(*this); }
+    void gather() { algo().gather(*this); }
     void post()
     {
-        algo.post(*this);
+        algo().post(*this);
         DPU_ASSERT(dpu_callback(m_rank, Rank<App>::rank_done, this, DPU_CALLBACK_ASYNC));
     };
 
@@ -101,11 +240,6 @@ public:
     Rank(Rank &&) = delete;
     Rank &operator=(const Rank &) = delete;
     Rank &operator=(Rank &&) = delete;
-    ~Rank()
-    {
-        if (m_valid)
-            dpu_free(m_rank);
-    }
 };
 
 #endif /* BFFF1F0E_2A88_4908_A231_706B5C411C97 */
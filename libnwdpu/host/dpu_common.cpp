@@ -2,9 +2,15 @@
  * Copyright 2022 - UPMEM
  */
 
+#include <cmath>
+#include <deque>
+#include <future>
+#include <unordered_map>
+
 #include "dpu_common.hpp"
 #include "PiM.hpp"
 #include "AppSet.hpp"
+#include "AppPair.hpp"
 #include "App16S.hpp"
 
 extern "C"
@@ -12,104 +18,413 @@ extern "C"
 #include <dpu.h>
 }
 
-std::vector<NwType> dpu_cigar_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &p, size_t n_ranks, const Sets &sets)
+/**
+ * @brief Set pipeline, results are given to the writer batch by batch if any, and to the sink window by window
+ *
+ */
+static void set_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &p, size_t n_ranks, const SetWindowSource &source, const SetWindowSink &sink, ResultWriter *writer,
+                         std::optional<Representative> star = std::nullopt)
 {
-
     PiM<AppSet> accelerator(dpu_bin_path, n_ranks);
     accelerator.Print();
 
-    auto index = sorted_map(sets);
+    std::deque<SetWindow> windows;
+    BatchSignal batch_signal;
+    size_t staged = 0; // ranks holding a prepared batch not dispatched yet
+
+    // dpu inputs of a batch are packed in parallel, several ranks being staged at once
+    ThreadPool packers(std::thread::hardware_concurrency());
+    SetStageTimes times;
+    SetTransferStats transfers;
+    CostModel cost_model;
+    CigarBudget cigar_budget;
 
-    auto index_span = std::span<SortedMap>(index);
-    std::vector<NwType> cpu_output(count_unique_pair(sets));
+    // takes the next bucket of the window for the rank, packed in its staging buffer in the background
+    auto stage = [&](Rank<AppSet> &rank, SetWindow &window, std::span<SortedMap> &index_span, size_t &total_set)
+    {
+        const Time start{CLOCK_MONOTONIC_RAW};
+        auto &algo = rank.staging();
+        algo.result = window.alignments.results;
+        algo.arena = &window.alignments.cigars;
+        algo.pending = &window.pending;
+        algo.batch_signal = &batch_signal;
+        algo.blocks_left = window.blocks_left.get();
+        algo.writer = writer;
+        algo.first_chunk = window.first_chunk;
+        algo.pool = &packers;
+        algo.times = &times;
+        algo.transfers = &transfers;
+        algo.cost_model = &cost_model;
+        algo.cigar_budget = &cigar_budget;
+        algo.get_bucket(index_span, total_set, n_ranks);
+        window.pending++;
+        staged++;
+        times.bucket.add(start);
 
-    size_t total_set = index_span.size();
+        rank.stage([&window, &p, &times](AppSet &a)
+                   {
+                       const Time pack_start{CLOCK_MONOTONIC_RAW};
+                       a.to_dpu_format(window.sets, p);
+                       times.pack.add(pack_start); });
+    };
 
-    while (!index_span.empty())
+    auto dispatch = [&](Rank<AppSet> &rank)
     {
-        auto &rank = accelerator.get_free_rank();
-        rank.algo.get_bucket(index_span, total_set, n_ranks);
-        rank.algo.result = cpu_output;
-        rank.algo.to_dpu_format(sets, p);
+        const Time start{CLOCK_MONOTONIC_RAW};
+        rank.use_staged();
+        staged--;
+        times.wait.add(start);
 
+        const Time dispatch_start{CLOCK_MONOTONIC_RAW};
         rank.send();
         rank.launch();
         rank.gather();
         rank.post();
+        times.dispatch.add(dispatch_start);
+    };
+
+    // dispatches all the staged batches, ranks without one are kept aside meanwhile
+    auto dispatch_staged = [&]()
+    {
+        std::vector<Rank<AppSet> *> idle;
+        while (staged > 0)
+        {
+            auto &rank = accelerator.get_free_rank();
+            if (rank.has_staged())
+                dispatch(rank);
+            else
+                idle.push_back(&rank);
+        }
+        for (auto *r : idle)
+            r->release();
+    };
+
+    // flush completed windows in order, the last one is kept while it is being dispatched
+    auto flush = [&](size_t keep)
+    {
+        while (windows.size() > keep && windows.front().done())
+        {
+            if (sink)
+                sink(std::move(windows.front().alignments));
+            windows.pop_front();
+        }
+    };
+
+    // waits for the oldest window to be done, then flushes it
+    auto drain = [&]()
+    {
+        batch_signal.wait([&]
+                          { return windows.front().done(); });
+        flush(0);
+    };
+
+    auto next = std::async(std::launch::async, std::cref(source));
+
+    while (auto sets = next.get())
+    {
+        // bound memory: at most two windows are aligned while the next one is read
+        if (windows.size() > 1)
+            dispatch_staged();
+        while (windows.size() > 1)
+            drain();
+
+        next = std::async(std::launch::async, std::cref(source));
+
+        auto &window = windows.emplace_back(std::move(*sets), star);
+        if (writer != nullptr)
+            window.first_chunk = writer->reserve(window.sets.number_of_sets());
+        auto index_span = std::span<SortedMap>(window.index);
+        size_t total_set = index_span.size();
+
+        while (!index_span.empty())
+        {
+            auto &rank = accelerator.get_free_rank();
+            flush(1);
+
+            if (!rank.has_staged())
+                stage(rank, window, index_span, total_set);
+            dispatch(rank);
+
+            // the next batch of the rank is packed while this one runs
+            if (!index_span.empty())
+                stage(rank, window, index_span, total_set);
+        }
+        window.dispatched = true;
     }
 
+    dispatch_staged();
     accelerator.sync();
+    accelerator.PrintIdleStats();
+    times.Print();
+    transfers.Print();
+    cost_model.Print();
+    cigar_budget.Print();
 
-    // Add to dump DPU counters and analyse their individual workload.
-    // dump_to_file("counters.txt", dpu_outputs, [](const auto &e) { return e.perf_counter; });
+    // the last batches may still be serialized by the writer
+    while (!windows.empty())
+        drain();
+}
 
-    return cpu_output;
+void dpu_cigar_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &p, size_t n_ranks, const SetWindowSource &source, ResultWriter &writer,
+                        std::optional<Representative> star, const SetWindowSink &sink)
+{
+    set_pipeline(std::move(dpu_bin_path), p, n_ranks, source, sink, &writer, star);
+    writer.finish();
 }
 
-auto Set_to_dpuSet(const Set &data, const NwParameters &params)
+SetAlignments dpu_cigar_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &p, size_t n_ranks, const SequenceStore &sets)
 {
-    NwInputScore dpu_input;
+    SetAlignments cpu_output;
+    bool sent = false;
 
-    dpu_input.sequences.reserve(SCORE_MAX_SEQUENCES_TOTAL_SIZE);
-    dpu_input.metadata.match = params.match;
-    dpu_input.metadata.mismatch = params.mismatch;
-    dpu_input.metadata.gap_extension = params.gap_extension;
-    dpu_input.metadata.gap_opening = params.gap_opening;
+    set_pipeline(
+        std::move(dpu_bin_path), p, n_ranks,
+        [&]() -> std::optional<SequenceStore>
+        {
+            if (sent)
+                return std::nullopt;
+            sent = true;
+            return sets;
+        },
+        [&](SetAlignments &&results)
+        { cpu_output = std::move(results); },
+        nullptr);
+
+    return cpu_output;
+}
+
+void dpu_pair_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &p, size_t n_ranks, const SequenceStore &sequences, std::span<const SequencePair> pairs, ResultWriter &writer)
+{
+    PiM<AppPair> accelerator(dpu_bin_path, n_ranks);
+    accelerator.Print();
 
-    size_t dpu_index = 0;
-    size_t seq_id = 0;
+    // each dpu is given at most its share of the list
+    CostSample share{};
+    for (const auto &[first, second] : pairs)
+    {
+        share.diagonals += static_cast<double>(sequences.length(first) + sequences.length(second) - 1);
+        share.pairs++;
+    }
+    share.diagonals /= static_cast<double>(accelerator.number_of_dpus());
+    share.pairs /= static_cast<double>(accelerator.number_of_dpus());
 
-    auto cset = compress_set(data);
+    SetTransferStats transfers;
+    CostModel cost_model;
+    CigarBudget cigar_budget;
 
-    for (size_t i = 0; i < cset.size(); i++)
+    size_t next = 0;
+    while (next < pairs.size())
     {
-        assert(seq_id < DPU_MAX_NUMBER_OF_SEQUENCES_MRAM && "Set is too big!\n");
-        dpu_input.sequence_metadata.lengths[seq_id] = static_cast<uint16_t>(data[i].size());
-        dpu_input.sequence_metadata.indexes[seq_id] = static_cast<uint32_t>(dpu_index);
-        dpu_index += cset[i].size();
-        seq_id++;
+        auto &rank = accelerator.get_free_rank();
+        auto &algo = rank.algo();
+        algo.writer = &writer;
+        algo.transfers = &transfers;
+        algo.cost_model = &cost_model;
+        algo.cigar_budget = &cigar_budget;
+
+        algo.get_batch(sequences, pairs, next, share, p);
+        algo.chunk = writer.reserve(1);
+
+        rank.send();
+        rank.launch();
+        rank.gather();
+        rank.post();
     }
 
-    for (const auto &seq : cset)
-        push_back(dpu_input.sequences, seq);
+    accelerator.sync();
+    accelerator.PrintIdleStats();
+    transfers.Print();
+    cost_model.Print();
+    cigar_budget.Print();
 
-    assert(dpu_input.sequences.size() < SCORE_MAX_SEQUENCES_TOTAL_SIZE &&
+    // the cigars of the last batches are read by the writer until it is done
+    writer.finish();
+}
+
+/// @brief True if the whole dataset fits the buffers of a dpu, so it can be broadcast
+static bool fits_dpu(const SequenceStore &data)
+{
+    return data.size() <= DPU_MAX_NUMBER_OF_SEQUENCES_MRAM && data.data.size() < SCORE_MAX_SEQUENCES_TOTAL_SIZE;
+}
+
+static NwMetadataDPU score_parameters(const NwParameters &params)
+{
+    NwMetadataDPU metadata{};
+
+    metadata.match = params.match;
+    metadata.mismatch = params.mismatch;
+    metadata.gap_extension = params.gap_extension;
+    metadata.gap_opening = params.gap_opening;
+
+    return metadata;
+}
+
+auto Set_to_dpuSet(const SequenceStore &data, const NwParameters &params)
+{
+    NwInputScore dpu_input;
+
+    dpu_input.metadata = score_parameters(params);
+
+    assert(data.size() <= DPU_MAX_NUMBER_OF_SEQUENCES_MRAM && "Set is too big!\n");
+    assert(data.data.size() < SCORE_MAX_SEQUENCES_TOTAL_SIZE &&
            "dpu sequence buffer overflow!\n");
 
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        dpu_input.sequence_metadata.lengths[i] = static_cast<uint16_t>(data.length(i));
+        dpu_input.sequence_metadata.indexes[i] = static_cast<uint32_t>(data.offsets[i]);
+    }
+
     return dpu_input;
 }
 
-std::vector<int> dpu_16s_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &p, size_t n_ranks, const Set &set)
+/**
+ * @brief All against all of a dataset too big for a dpu, by tiles of a row block and a column block.
+ * A tile fills the output buffer of a dpu. Each rank takes whole row blocks and runs through their columns, so a row
+ * block is uploaded by a single rank, broadcast to its dpus. Once all the rows are taken, a rank without work takes
+ * the second half of the columns left to the rank with the most.
+ *
+ * @param accelerator
+ * @param set dataset
+ * @param scores
+ * @param n_ranks
+ * @param rows rows of the matrix computed, the blocks start at the first one
+ * @return number of launches
+ */
+static size_t tiled_16s_pipeline(PiM<App16S> &accelerator, const SequenceStore &set, ScoreMatrix &scores, size_t n_ranks, const ScoreShard &rows)
 {
+    // tiles of block_size rows and columns fill the output buffer
+    const auto block_size = static_cast<size_t>(std::sqrt(static_cast<double>(SCORE_METADATA_MAX_NUMBER_OF_SCORES_MRAM)));
+    ScoreTiling tiling(set, block_size, rows.first_row, rows.last_row);
+    const auto n_blocks = tiling.size();
+    const auto row_blocks = tiling.blocks_before(rows.last_row);
+    printf("Tiled dataset: %lu blocks of at most %lu sequences, %lu tiles\n",
+           n_blocks, std::min(block_size, SCORE_TILE_MAX_NUMBER_OF_SEQUENCES), row_blocks * n_blocks - sum_integers(row_blocks));
+
+    // tiles of a rank: columns [col, end) of a row block
+    struct RankWork
+    {
+        size_t row{};
+        size_t col{};
+        size_t end{};
+    };
+    std::unordered_map<Rank<App16S> *, RankWork> work;
+    size_t next_row = 0;
+
+    auto take_work = [&](RankWork &w)
+    {
+        if (next_row < row_blocks)
+        {
+            w = {next_row, next_row, n_blocks};
+            next_row++;
+            return true;
+        }
+
+        auto busiest = std::ranges::max_element(work, {}, [](const auto &e)
+                                                { return e.second.end - e.second.col; });
+        auto &other = busiest->second;
+        const auto half = (other.end - other.col) / 2;
+        if (half == 0)
+            return false;
+        w = {other.row, other.end - half, other.end};
+        other.end -= half;
+        return true;
+    };
+
+    size_t launches = 0;
+    size_t idle = 0;
+
+    while (idle < n_ranks)
+    {
+        auto &rank = accelerator.get_free_rank();
+        auto &w = work[&rank];
+        auto &algo = rank.algo();
+        algo.p_results = &scores;
+        algo.tiling = &tiling;
+        algo.columns = &tiling;
+        algo.clear_jobs();
+
+        size_t i = 0;
+        while (i < rank.size() && (w.col < w.end || take_work(w)))
+            algo.add_tile(i++, w.row, w.col++);
+
+        // the rank is kept out of the ready queue once there is nothing left for it
+        if (i == 0)
+        {
+            idle++;
+            continue;
+        }
+
+        launches++;
+        rank.send();
+        rank.launch();
+        rank.gather();
+        rank.post();
+    }
+
+    accelerator.sync();
+    return launches;
+}
+
+void dpu_16s_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &p, size_t n_ranks, const SequenceStore &set, ScoreMatrix &scores, size_t jobs_per_launch,
+                      std::optional<ScoreShard> shard)
+{
+    const auto rows = shard.value_or(ScoreShard{0, set.size()});
 
     PiM<App16S> accelerator(dpu_bin_path, n_ranks);
     accelerator.Print();
 
+    if (!fits_dpu(set))
+    {
+        auto metadata = score_parameters(p);
+        accelerator.send_all(metadata, "metadata");
+        printf("Launches: %lu\n", tiled_16s_pipeline(accelerator, set, scores, n_ranks, rows));
+        accelerator.PrintIdleStats();
+        return;
+    }
+
     auto dpu_dataset = Set_to_dpuSet(set, p);
-    accelerator.send_all(dpu_dataset.sequences, "sequences");
+    accelerator.send_all(set.data, "sequences");
     accelerator.send_all(dpu_dataset.metadata, "metadata");
     accelerator.send_all(dpu_dataset.sequence_metadata, "sequence_metadata");
 
-    std::vector<int> cpu_output(sum_integers(set.size()));
-
-    auto total_size = sum_integers(set.size());
+    // the pairs of the rows are consecutive in the triangular matrix
+    auto total_size = row_begin(rows.last_row, set.size()) - row_begin(rows.first_row, set.size());
 
     ComparisonMetadata meta{
+        static_cast<uint32_t>(rows.first_row),
+        static_cast<uint32_t>(rows.first_row + 1),
         0,
-        1,
+        static_cast<uint32_t>(set.size()),
         0,
-        static_cast<uint32_t>(set.size())};
+        0};
 
-    while (total_size > 0)
+    auto batch_size = [&]()
     {
         auto thr = std::min(total_size / 80, 100000UL);
         auto i = std::max(thr, 512UL);
-        i = std::min(i, total_size);
-        total_size -= i;
+        return std::min(i, total_size);
+    };
+
+    size_t launches = 0;
+
+    while (total_size > 0)
+    {
         auto &rank = accelerator.get_free_rank();
-        rank.algo.p_results = &cpu_output;
-        rank.algo.get_bucket(meta, i);
+        auto &algo = rank.algo();
+        algo.p_results = &scores;
+        algo.clear_jobs();
 
+        // consecutive batches are posted as jobs of a single launch, to amortize its cost, the last batch
+        // of each rank is launched alone so that the ranks finish together
+        do
+        {
+            auto i = batch_size();
+            total_size -= i;
+            algo.add_job(meta, i);
+        } while (total_size > batch_size() * n_ranks && algo.number_of_jobs() < jobs_per_launch && algo.fits(batch_size()));
+
+        launches++;
         rank.send();
         rank.launch();
         rank.gather();
@@ -117,6 +432,80 @@ std::vector<int> dpu_16s_pipeline(std::filesystem::path dpu_bin_path, const NwPa
     }
 
     accelerator.sync();
+    printf("Launches: %lu\n", launches);
+    accelerator.PrintIdleStats();
+}
 
-    return cpu_output;
-}
\ No newline at end of file
+void dpu_search_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &p, size_t n_ranks, const SequenceStore &database, const SequenceStore &queries, SearchHits &hits)
+{
+    PiM<App16S> accelerator(dpu_bin_path, n_ranks);
+    accelerator.Print();
+
+    if (database.size() == 0 || queries.size() == 0)
+        return;
+
+    auto metadata = score_parameters(p);
+    accelerator.send_all(metadata, "metadata");
+
+    // a partition of the database per dpu, a query batch fills the output buffer of the dpu holding the biggest one
+    const auto n_dpu = accelerator.number_of_dpus();
+    ScoreTiling partitions(database, (database.size() + n_dpu - 1) / n_dpu);
+    size_t widest = 1;
+    for (size_t b = 0; b < partitions.size(); b++)
+        widest = std::max(widest, partitions.count(b));
+    ScoreTiling batches(queries, SCORE_METADATA_MAX_NUMBER_OF_SCORES_MRAM / widest);
+
+    printf("Search:\n"
+           "  %lu database partitions of at most %lu sequences\n"
+           "  %lu query batches\n\n",
+           partitions.size(), widest, batches.size());
+
+    // a rank takes a group of partitions, one per dpu, and runs all the query batches against it before taking another
+    struct RankWork
+    {
+        size_t first{}; /// first partition of the group
+        size_t count{}; /// number of partitions of the group
+        size_t batch{}; /// next query batch
+    };
+    std::unordered_map<Rank<App16S> *, RankWork> work;
+    size_t next_partition = 0;
+    size_t idle = 0;
+    size_t launches = 0;
+
+    while (idle < n_ranks)
+    {
+        auto &rank = accelerator.get_free_rank();
+        auto &w = work[&rank];
+
+        if (w.count == 0 || w.batch == batches.size())
+        {
+            // the rank is kept out of the ready queue once there is nothing left for it
+            if (next_partition == partitions.size())
+            {
+                idle++;
+                continue;
+            }
+            w = {next_partition, std::min(rank.size(), partitions.size() - next_partition), 0};
+            next_partition += w.count;
+        }
+
+        auto &algo = rank.algo();
+        algo.tiling = &batches;
+        algo.columns = &partitions;
+        algo.p_hits = &hits;
+        algo.clear_jobs();
+        for (size_t i = 0; i < w.count; i++)
+            algo.add_tile(i, w.batch, w.first + i);
+        w.batch++;
+
+        launches++;
+        rank.send();
+        rank.launch();
+        rank.gather();
+        rank.post();
+    }
+
+    accelerator.sync();
+    printf("Launches: %lu\n", launches);
+    accelerator.PrintIdleStats();
+}
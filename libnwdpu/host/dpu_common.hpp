@@ -5,7 +5,14 @@
 #ifndef E6039E80_5D9F_462C_ACAE_D977B65797AC
 #define E6039E80_5D9F_462C_ACAE_D977B65797AC
 
-#include "../../src/types.hpp"
+#include <climits>
+#include <mutex>
+
+#include "../../src/cigar_arena.hpp"
+#include "../../src/representative.hpp"
+#include "../../src/result_writer.hpp"
+#include "../../src/score_matrix.hpp"
+#include "../../src/sequence_store.hpp"
 
 /**
  * @brief Structure regrouping all data to be send to a dpu for Cigar
@@ -14,23 +21,57 @@
 struct NwInputCigar
 {
     /// @brief Input data for Cigar NW
-    NwMetadataDPU metadata{};              /// metadata describing the sequences
-    CompressedSequences sequences{};       /// all sequences in are compressed into one single buffer
-    std::vector<uint32_t> cigar_indexes{}; /// start index of each cigar memory space
+    NwMetadataDPU metadata{};        /// metadata describing the sequences
+    CompressedSequences sequences{}; /// all sequences in are compressed into one single buffer
 };
 
 /**
- * @brief Structure regrouping all data to be send to a dpu for Score
+ * @brief Structure regrouping all data to be send to a dpu for Score.
+ * Sequences are broadcast straight from the SequenceStore.
  *
  */
 struct NwInputScore
 {
     /// @brief Input data for Score NW
-    NwMetadataDPU metadata{};        /// metadata describing the sequences
-    CompressedSequences sequences{}; /// all sequences in are compressed into one single buffer
-    NwSequenceMetadataMram sequence_metadata{};
+    NwMetadataDPU metadata{};                   /// alignment parameters
+    NwSequenceMetadataMram sequence_metadata{}; /// index and length of each sequence in the store
 };
 
+/**
+ * @brief Best hit of each query of a search in a database, merged from the database partitions as they are gathered
+ *
+ */
+struct SearchHits
+{
+    std::vector<NwScoreHit> hits{}; /// best hit of each query, the target is a database sequence
+    std::mutex mutex{};
+
+    explicit SearchHits(size_t queries) : hits(queries, {INT32_MIN, UINT32_MAX}) {}
+
+    /// @brief Keeps the best score of a query, the lowest target on ties, whatever the order partitions are merged in
+    void merge(size_t query, NwScoreHit hit)
+    {
+        std::lock_guard lock(mutex);
+        auto &best = hits[query];
+        if (hit.score > best.score || (hit.score == best.score && hit.target < best.target))
+            best = hit;
+    }
+};
+
+/**
+ * @brief Results of the set pipeline, one per pair, with the storage of their CIGARs
+ *
+ */
+struct SetAlignments
+{
+    std::vector<NwType> results{};         /// results of all the pairs, set by set
+    CigarArena cigars{};                   /// CIGARs of the results
+    std::vector<uint32_t> representatives{}; /// star mode: representative of each set, index in the set
+};
+
+/// @brief Receives the results of a window of sets, windows are received in order
+using SetWindowSink = std::function<void(SetAlignments &&)>;
+
 /**
  * @brief DPU pipeline for CIGAR
  *
@@ -38,9 +79,42 @@ struct NwInputScore
  * @param params NW parameters
  * @param ranks Number of ranks to use
  * @param sets Dataset
- * @return std::vector<NwType>
+ * @return SetAlignments
+ */
+SetAlignments dpu_cigar_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &params, size_t ranks, const SequenceStore &sets);
+
+/**
+ * @brief Streaming DPU pipeline for CIGAR. The next window is read while the current
+ * one is scheduled, at most two windows are kept in memory along with the one being read.
+ * Results of a batch are handed to the writer as soon as its rank is post-processed,
+ * so writing overlaps the alignment. Returns once all results are written.
+ *
+ * In star mode each member of a set is only aligned with the representative of the set, k - 1 results
+ * per set in member order, the representative being the first sequence of each pair.
+ *
+ * @param dpu_bin_path DPU binary path
+ * @param params NW parameters
+ * @param ranks Number of ranks to use
+ * @param source Windows of the dataset
+ * @param writer Output of the results, one chunk per set
+ * @param star Star mode: how representatives are chosen, all the pairs of the sets are aligned if not set
+ * @param sink Receives each window once written, with its representatives in star mode, if set
  */
-std::vector<NwType> dpu_cigar_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &params, size_t ranks, const Sets &sets);
+void dpu_cigar_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &params, size_t ranks, const SetWindowSource &source, ResultWriter &writer,
+                        std::optional<Representative> star = std::nullopt, const SetWindowSink &sink = {});
+
+/**
+ * @brief DPU pipeline for CIGAR of an explicit pair list. Results are written in the order of the list,
+ * batch by batch as soon as their rank is post-processed. Returns once all results are written.
+ *
+ * @param dpu_bin_path DPU binary path
+ * @param params NW parameters
+ * @param ranks Number of ranks to use
+ * @param sequences Dataset
+ * @param pairs Pairs of sequences of the dataset to align
+ * @param writer Output of the results, one chunk per batch
+ */
+void dpu_pair_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &params, size_t ranks, const SequenceStore &sequences, std::span<const SequencePair> pairs, ResultWriter &writer);
 
 /**
  * @brief DPU pipeline for score
@@ -49,7 +123,24 @@ std::vector<NwType> dpu_cigar_pipeline(std::filesystem::path dpu_bin_path, const
  * @param params NW parameters
  * @param ranks Number of ranks to use
  * @param set Dataset
- * @return std::vector<int>
+ * @param scores Output matrix of set.size() sequences, scores are written in place as they are gathered
+ * @param jobs_per_launch Number of batches run by a single launch of the dpus, at most SCORE_MAILBOX_MAX_JOBS
+ * @param shard Rows of the matrix to compute, the ones stored by scores, all of them if not set
+ */
+void dpu_16s_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &p, size_t n_ranks, const SequenceStore &set, ScoreMatrix &scores, size_t jobs_per_launch = 8,
+                      std::optional<ScoreShard> shard = std::nullopt);
+
+/**
+ * @brief DPU pipeline searching queries in a database. The database is partitioned once between the dpus and kept
+ * in their buffers, query batches are broadcast and aligned against the resident partitions, the dpus only return
+ * the best hit of each query.
+ *
+ * @param dpu_bin_path DPU binary path
+ * @param params NW parameters
+ * @param ranks Number of ranks to use
+ * @param database Sequences searched
+ * @param queries Sequences to search
+ * @param hits Best hit of each query, merged as the partitions are gathered
  */
-std::vector<int> dpu_16s_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &p, size_t n_ranks, const Set &set);
+void dpu_search_pipeline(std::filesystem::path dpu_bin_path, const NwParameters &params, size_t ranks, const SequenceStore &database, const SequenceStore &queries, SearchHits &hits);
 #endif /* E6039E80_5D9F_462C_ACAE_D977B65797AC */
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#ifndef CD61FB62_94A7_4E85_953A_B7F9DB909F31
+#define CD61FB62_94A7_4E85_953A_B7F9DB909F31
+
+#include <atomic>
+
+#include "mapped_file.hpp"
+#include "types.hpp"
+
+/**
+ * @brief Storage of the run-length encoded CIGARs of many alignments, referenced by offset and length (see Cigar).
+ * The capacity is reserved at once for the worst case of the alignments, as an anonymous mapping whose pages are
+ * only allocated when written. Memory never moves, so ranges can be allocated by a rank post-process while the
+ * CIGARs of previous batches are read by other threads.
+ *
+ */
+class CigarArena
+{
+    MappedFile memory = MappedFile::anonymous(0);
+    std::atomic<uint64_t> end{0}; /// offset of the first byte free
+
+public:
+    CigarArena() = default;
+
+    /**
+     * @brief Reserves the capacity of the arena
+     *
+     * @param capacity bytes of the CIGARs of the alignments in the worst case
+     */
+    explicit CigarArena(size_t capacity) : memory(MappedFile::anonymous(capacity)) {}
+
+    CigarArena(CigarArena &&other) noexcept : memory(std::move(other.memory)), end(other.end.load()) {}
+
+    CigarArena &operator=(CigarArena &&other) noexcept
+    {
+        memory = std::move(other.memory);
+        end = other.end.load();
+        return *this;
+    }
+
+    /**
+     * @brief Allocates n contiguous bytes, thread safe
+     *
+     * @param n
+     * @return uint64_t offset of the range
+     */
+    uint64_t allocate(size_t n)
+    {
+        const auto offset = end.fetch_add(n);
+        if (offset + n > memory.getSize())
+            exit("CIGAR arena is full: " + std::to_string(offset + n) + " bytes for a capacity of " + std::to_string(memory.getSize()));
+        return offset;
+    }
+
+    /// @brief Memory of the range starting at offset
+    uint8_t *data(uint64_t offset) { return reinterpret_cast<uint8_t *>(memory.getData()) + offset; }
+
+    /// @brief Runs of a CIGAR
+    CigarView operator[](const Cigar &cigar) const
+    {
+        if (cigar.length == 0)
+            return {};
+        return {{reinterpret_cast<const uint8_t *>(memory.getData()) + cigar.offset, cigar.length}};
+    }
+
+    /// @brief Number of bytes allocated
+    uint64_t size() const { return end; }
+};
+
+#endif /* CD61FB62_94A7_4E85_953A_B7F9DB909F31 */
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include <cstring>
+#include <sstream>
+
+#include "dataset_cache.hpp"
+#include "fasta.hpp"
+
+static constexpr char cache_magic[8] = "NWDPUDS";
+static constexpr uint32_t cache_version = 1;
+
+template <typename T>
+static uint64_t write_section(std::ofstream &file, std::span<const T> section)
+{
+    const auto offset = static_cast<uint64_t>(file.tellp());
+    const auto size = section.size_bytes();
+    file.write(reinterpret_cast<const char *>(section.data()), static_cast<std::streamsize>(size));
+
+    constexpr char padding[8] = {};
+    file.write(padding, static_cast<std::streamsize>(round_up8(size) - size));
+
+    return offset;
+}
+
+bool is_dataset_cache(const std::filesystem::path &filename)
+{
+    char magic[sizeof(cache_magic)] = {};
+    std::ifstream file(filename, std::ios::binary);
+    file.read(magic, sizeof(magic));
+    return file && std::memcmp(magic, cache_magic, sizeof(magic)) == 0;
+}
+
+void write_dataset_cache(const SequenceStore &store, DatasetKind kind, const std::filesystem::path &filename)
+{
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file)
+        exit("Can not write dataset cache: " + filename.native());
+
+    DatasetCacheHeader header{};
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.kind = kind;
+    header.number_of_sequences = store.size();
+    header.number_of_sets = store.number_of_sets();
+    header.data_size = store.data.size();
+
+    // header is written twice, once to reserve its space and once with the section offsets
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    header.lengths_offset = write_section(file, store.lengths);
+    header.offsets_offset = write_section(file, store.offsets);
+    header.set_offsets_offset = write_section(file, store.set_offsets);
+    header.data_offset = write_section(file, store.data);
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    if (!file)
+        exit("Error writing dataset cache: " + filename.native());
+}
+
+SequenceStore read_dataset_cache(const std::filesystem::path &filename, DatasetKind kind)
+{
+    auto file = std::make_shared<const MappedFile>(filename);
+    const auto *base = reinterpret_cast<const uint8_t *>(file->getData());
+    const auto size = file->getSize();
+
+    DatasetCacheHeader header{};
+    if (size < sizeof(header))
+        exit("Invalid dataset cache: " + filename.native());
+    std::memcpy(&header, base, sizeof(header));
+
+    if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != cache_version)
+        exit("Invalid dataset cache version: " + filename.native());
+
+    if (header.kind != kind)
+        exit("Dataset cache holds another kind of dataset: " + filename.native());
+
+    const auto n = header.number_of_sequences;
+    if (n > size / sizeof(uint64_t) || header.number_of_sets >= size / sizeof(uint64_t) ||
+        header.lengths_offset > size || header.lengths_offset + n * sizeof(uint32_t) > size ||
+        header.offsets_offset > size || header.offsets_offset + n * sizeof(uint64_t) > size ||
+        header.set_offsets_offset > size || header.set_offsets_offset + (header.number_of_sets + 1) * sizeof(uint64_t) > size ||
+        header.data_offset > size || header.data_size > size - header.data_offset)
+        exit("Truncated dataset cache: " + filename.native());
+
+    // sections are viewed in place, they must be aligned
+    if (header.lengths_offset % 8 != 0 || header.offsets_offset % 8 != 0 || header.set_offsets_offset % 8 != 0)
+        exit("Invalid dataset cache: " + filename.native());
+
+    const std::span<const uint64_t> offsets(reinterpret_cast<const uint64_t *>(base + header.offsets_offset), n);
+    const std::span<const uint32_t> lengths(reinterpret_cast<const uint32_t *>(base + header.lengths_offset), n);
+    const std::span<const uint64_t> set_offsets(reinterpret_cast<const uint64_t *>(base + header.set_offsets_offset), header.number_of_sets + 1);
+
+    // every sequence lies in the data and the sets split the sequences in order, so the store is never read out of bounds
+    for (size_t i = 0; i < n; i++)
+        if (offsets[i] > header.data_size || compressed_size(lengths[i]) > header.data_size - offsets[i])
+            exit("Invalid dataset cache: " + filename.native());
+    for (size_t s = 1; s < set_offsets.size(); s++)
+        if (set_offsets[s] < set_offsets[s - 1])
+            exit("Invalid dataset cache: " + filename.native());
+    if (set_offsets.front() != 0 || set_offsets.back() != n)
+        exit("Invalid dataset cache: " + filename.native());
+
+    return SequenceStore(file, {base + header.data_offset, header.data_size}, offsets, lengths, set_offsets);
+}
+
+SequenceStore load_set_dataset(const std::filesystem::path &filename)
+{
+    if (is_dataset_cache(filename))
+        return read_dataset_cache(filename, DatasetKind::Sets);
+
+    return read_set_fasta(filename);
+}
+
+SequenceStore load_seq_dataset(const std::filesystem::path &filename)
+{
+    if (is_dataset_cache(filename))
+        return read_dataset_cache(filename, DatasetKind::Sequences);
+
+    return read_seq_fasta(filename);
+}
+
+std::vector<SequencePair> load_pair_list(const std::filesystem::path &filename, size_t number_of_sequences)
+{
+    std::ifstream file(filename);
+    if (!file)
+        exit("Can not read pair list: " + filename.native());
+
+    std::vector<SequencePair> pairs;
+    std::string line;
+    for (size_t n = 1; std::getline(file, line); n++)
+    {
+        const auto start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+
+        std::istringstream fields(line);
+        uint64_t first = 0;
+        uint64_t second = 0;
+        if (!(fields >> first >> second) || first >= number_of_sequences || second >= number_of_sequences)
+            exit("Invalid pair line " + std::to_string(n) + " of " + filename.native());
+
+        pairs.push_back({static_cast<uint32_t>(first), static_cast<uint32_t>(second)});
+    }
+
+    return pairs;
+}
+
+SetWindowSource stream_set_dataset(const std::filesystem::path &filename, size_t window_bytes, size_t max_sets)
+{
+    if (!is_dataset_cache(filename))
+    {
+        auto stream = std::make_shared<FastaSetStream>(filename, window_bytes, max_sets);
+        return [stream]()
+        { return stream->next(); };
+    }
+
+    // a cache is already mapped, windows are slices of it
+    auto store = read_dataset_cache(filename, DatasetKind::Sets);
+    store.truncate_sets(max_sets);
+
+    return [store, window_bytes, first = size_t{0}]() mutable -> std::optional<SequenceStore>
+    {
+        if (first == store.number_of_sets())
+            return std::nullopt;
+
+        size_t last = first;
+        size_t bytes = 0;
+        while (last < store.number_of_sets() && (last == first || bytes < window_bytes))
+            bytes += store.packed_set(last++).size();
+
+        auto window = store.slice_sets(first, last);
+        first = last;
+        return window;
+    };
+}
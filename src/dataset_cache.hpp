@@ -0,0 +1,103 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#ifndef B577DE16_152B_45E1_9C58_8E1C1CD39949
+#define B577DE16_152B_45E1_9C58_8E1C1CD39949
+
+#include "sequence_store.hpp"
+
+/**
+ * @brief Kind of dataset stored in a cache
+ *
+ */
+enum class DatasetKind : uint32_t
+{
+    Sets = 0,     /// sequences grouped by set id, for set comparison
+    Sequences = 1 /// a single collection of sequences, for all against all comparison
+};
+
+/**
+ * @brief Header of a dataset cache file.
+ * A cache is a SequenceStore written as is: every section is 8 bytes aligned
+ * and the packed sequences already are in the dpu layout, so a mapped cache
+ * can be used without any parsing or encoding.
+ *
+ */
+struct DatasetCacheHeader
+{
+    /// @brief File layout
+    char magic[8];                /// "NWDPUDS" followed by a null byte
+    uint32_t version;             /// format version
+    DatasetKind kind;             /// kind of dataset
+    uint64_t number_of_sequences; /// number of sequences
+    uint64_t number_of_sets;      /// number of sets
+    uint64_t lengths_offset;      /// file offset of lengths, uint32_t[number_of_sequences]
+    uint64_t offsets_offset;      /// file offset of offsets, uint64_t[number_of_sequences]
+    uint64_t set_offsets_offset;  /// file offset of set offsets, uint64_t[number_of_sets + 1]
+    uint64_t data_offset;         /// file offset of packed sequences
+    uint64_t data_size;           /// size in bytes of packed sequences
+};
+
+/**
+ * @brief Returns true if the file is a dataset cache
+ *
+ * @param filename
+ */
+bool is_dataset_cache(const std::filesystem::path &filename);
+
+/**
+ * @brief Writes a store into a dataset cache file
+ *
+ * @param store
+ * @param kind
+ * @param filename
+ */
+void write_dataset_cache(const SequenceStore &store, DatasetKind kind, const std::filesystem::path &filename);
+
+/**
+ * @brief Maps a dataset cache, the returned store views the mapping
+ *
+ * @param filename
+ * @param kind expected kind of dataset, exits if the cache holds another kind
+ * @return SequenceStore
+ */
+SequenceStore read_dataset_cache(const std::filesystem::path &filename, DatasetKind kind);
+
+/**
+ * @brief Loads a set comparison dataset, either from a dataset cache or from a fasta file
+ *
+ * @param filename
+ * @return SequenceStore
+ */
+SequenceStore load_set_dataset(const std::filesystem::path &filename);
+
+/**
+ * @brief Loads an all against all dataset, either from a dataset cache or from a fasta file
+ *
+ * @param filename
+ * @return SequenceStore
+ */
+SequenceStore load_seq_dataset(const std::filesystem::path &filename);
+
+/**
+ * @brief Reads a pair list: one pair per line, the indexes of its two sequences in the dataset separated by spaces.
+ * Empty lines and lines starting with '#' are skipped.
+ *
+ * @param filename
+ * @param number_of_sequences size of the dataset, exits if a pair is out of it
+ * @return std::vector<SequencePair> pairs in file order
+ */
+std::vector<SequencePair> load_pair_list(const std::filesystem::path &filename, size_t number_of_sequences);
+
+/**
+ * @brief Streams a set comparison dataset window by window, either from a dataset cache or from a fasta file
+ *
+ * @param filename
+ * @param window_bytes size of a window, in bytes of fasta file or of packed sequences for a cache
+ * @param max_sets number of sets to read at most
+ * @return SetWindowSource
+ */
+SetWindowSource stream_set_dataset(const std::filesystem::path &filename, size_t window_bytes, size_t max_sets);
+
+#endif /* B577DE16_152B_45E1_9C58_8E1C1CD39949 */
@@ -5,22 +5,116 @@
 #ifndef D6AA45B0_8C2F_470E_9570_4BF160F4C5EE
 #define D6AA45B0_8C2F_470E_9570_4BF160F4C5EE
 
-#include "types.hpp"
+#include <memory>
+#include <optional>
+#include <string_view>
+
+#include "gzip.hpp"
+#include "mapped_file.hpp"
+#include "sequence_store.hpp"
+
+/**
+ * @brief A fasta record. Both fields are views into the mapped file.
+ *
+ */
+struct FastaRecord
+{
+    /// @brief Record views
+    std::string_view header;   /// header line without the leading '>'
+    std::string_view sequence; /// sequence, multi-line sequences are joined in place
+};
+
+/**
+ * @brief A mapped fasta file and the records it contains.
+ * Records are only valid as long as the FastaFile is alive.
+ *
+ */
+struct FastaFile
+{
+    /// @brief Mapping and records
+    MappedFile file;                  /// memory mapping of the file or of its decompressed content, owns the records data
+    std::vector<FastaRecord> records; /// records in file order
+};
+
+/**
+ * @brief Maps a fasta file and parses it in parallel, without copying sequences.
+ * gzip and BGZF files are decompressed in memory first.
+ *
+ * @param filename
+ * @return Mapped file with all its records
+ */
+FastaFile read_fasta(const std::filesystem::path &filename);
+
+/**
+ * @brief Reads a set fasta file window by window, to bound memory on large datasets.
+ * A window holds the complete sets parsed from about window_bytes of file. Pages of
+ * the mapping are released once their sets are packed. Sequences with the same set id
+ * must be contiguous, exits otherwise: the ids streamed are kept, one bit per id. A gzip
+ * or BGZF file is decompressed as the windows are read, about window_bytes at a time,
+ * only the text of the window being parsed is kept.
+ *
+ */
+class FastaSetStream
+{
+    MappedFile file;                        /// mapping of an uncompressed file
+    std::unique_ptr<GzipReader> gzip{};     /// decompresses a compressed file window by window
+    std::vector<char> buffer{};             /// decompressed text not yet packed, for a compressed file
+    char *text_begin{};                     /// text available, the whole mapping or the buffer
+    char *text_end{};
+    char *position{};                       /// first record not parsed
+    size_t window_bytes;
+    size_t remaining_sets;
+    std::vector<FastaRecord> carry{};       /// records of the last set of a window, it may continue in the next one
+    std::vector<bool> streamed_ids{};       /// ids of the sets streamed, a set coming back later is not contiguous
+
+    /// @brief Returns true once the whole file is parsed
+    bool at_end() const;
+
+    /// @brief Decompresses about window_bytes more, the text before the records is dropped and the records are moved with their bytes
+    void refill(std::vector<FastaRecord> &records);
+
+public:
+    /**
+     * @brief Maps a set fasta file, nothing is parsed yet
+     *
+     * @param filename
+     * @param window_bytes number of bytes of file parsed per window
+     * @param max_sets number of sets to read at most
+     */
+    FastaSetStream(const std::filesystem::path &filename, size_t window_bytes, size_t max_sets);
+
+    /**
+     * @brief Parses the next window
+     *
+     * @return Packed sets of the window, std::nullopt when the file is fully read
+     */
+    std::optional<SequenceStore> next();
+};
+
+/**
+ * @brief Parse the set id of a header of the form "set {set_number} ..."
+ *
+ * @param header
+ * @return Set id
+ */
+int parse_set_id(std::string_view header);
 
 /**
- * @brief Reads a fasta file with all sequences having a set id in comment
+ * @brief Reads a fasta file with all sequences having a set id in comment.
+ * Sequences are grouped by set id in parallel, they do not need to be contiguous.
+ * Sets are ordered by their first sequence in the file, sequences of a set keep the file order.
  *
  * @param filename
- * @return A vector of set
+ * @return Packed sequences grouped by set
  */
-Sets read_set_fasta(const std::filesystem::path &filename);
+SequenceStore read_set_fasta(const std::filesystem::path &filename);
 
 /**
  * @brief Reads all sequences in a fasta file
  *
  * @param filename
- * @return A vector of sequences
+ * @return Packed sequences, all in a single set
  */
-Set read_seq_fasta(const std::filesystem::path &filename);
+SequenceStore read_seq_fasta(const std::filesystem::path &filename);
 
 #endif /* D6AA45B0_8C2F_470E_9570_4BF160F4C5EE */
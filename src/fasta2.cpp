@@ -1,137 +1,413 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
 #include <algorithm>
-#include <fstream>
-#include <sys/mman.h> // for mmap
-#include <fcntl.h>    // for open
-#include <unistd.h>   // for close
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <omp.h>
+#include <unordered_map>
 
 #include "fasta.hpp"
+#include "gzip.hpp"
+#include "pack.hpp"
+
+static inline char *line_end(char *begin, char *end)
+{
+    auto *p = static_cast<char *>(memchr(begin, '\n', static_cast<size_t>(end - begin)));
+    return p == nullptr ? end : p;
+}
 
-class MappedFile
+static inline char *next_line(char *begin, char *end)
 {
-    char *data;
-    size_t size;
+    auto *p = line_end(begin, end);
+    return p == end ? end : p + 1;
+}
+
+/// Returns the first record start ('>' at the beginning of a line) at or after pos
+static char *next_record(char *data, char *pos, char *end)
+{
+    if (pos != data && pos[-1] != '\n')
+        pos = next_line(pos, end);
 
-public:
-    MappedFile() = delete;
+    while (pos < end && *pos != '>')
+        pos = next_line(pos, end);
 
-    MappedFile(const std::string &filename)
+    return pos;
+}
+
+/// Parses records in [begin, end), begin must be a record start and end a record start or end of file.
+/// Multi-line sequences are joined in place, the joined sequence never outgrows its own record.
+static std::vector<FastaRecord> parse_records(char *begin, char *end)
+{
+    std::vector<FastaRecord> records;
+    char *pos = begin;
+
+    while (pos < end)
     {
-        int fd = open(filename.c_str(), O_RDONLY);
-        if (fd == -1)
-        {
-            perror("Error opening file");
-            exit(EXIT_FAILURE);
-        }
+        char *header_end = line_end(pos, end);
+        size_t header_size = static_cast<size_t>(header_end - pos - 1);
+        if (header_size > 0 && pos[header_size] == '\r')
+            header_size--;
+        std::string_view header(pos + 1, header_size);
 
-        off_t s = lseek(fd, 0, SEEK_END);
-        if (s == -1)
-        {
-            perror("Error getting file size");
-            close(fd);
-            exit(EXIT_FAILURE);
-        }
+        pos = header_end == end ? end : header_end + 1;
 
-        size = s;
+        char *sequence = pos;
+        char *write = pos;
 
-        data = static_cast<char *>(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
-        if (data == MAP_FAILED)
+        while (pos < end && *pos != '>')
         {
-            perror("Error mapping file");
-            close(fd);
-            exit(EXIT_FAILURE);
+            char *le = line_end(pos, end);
+            auto n = static_cast<size_t>(le - pos);
+            if (n > 0 && pos[n - 1] == '\r')
+                n--;
+
+            // single-line records are left untouched, no page is copied
+            if (write != pos)
+                memmove(write, pos, n);
+            write += n;
+
+            pos = le == end ? end : le + 1;
         }
 
-        close(fd);
+        records.push_back({header, std::string_view(sequence, static_cast<size_t>(write - sequence))});
     }
 
-    MappedFile(const MappedFile &) = delete;
-    MappedFile(MappedFile &&) = delete;
-    MappedFile &operator=(const MappedFile &) = delete;
-    MappedFile &operator=(MappedFile &&) = delete;
+    return records;
+}
+
+/// Parses [begin, end) in parallel, begin must be a record start
+static std::vector<FastaRecord> parse_range(char *begin, char *end)
+{
+    const auto size = static_cast<size_t>(end - begin);
+
+    // Split the range in chunks starting on record boundaries, one per thread
+    const auto n_chunks = static_cast<size_t>(omp_get_max_threads());
+    std::vector<char *> bounds(n_chunks + 1, end);
+    for (size_t i = 0; i < n_chunks; i++)
+        bounds[i] = next_record(begin, begin + size * i / n_chunks, end);
+
+    std::vector<std::vector<FastaRecord>> chunks(n_chunks);
 
-    ~MappedFile()
+#pragma omp parallel for schedule(static, 1)
+    for (size_t i = 0; i < n_chunks; i++)
+        chunks[i] = parse_records(bounds[i], bounds[i + 1]);
+
+    std::vector<size_t> offsets(n_chunks + 1, 0);
+    for (size_t i = 0; i < n_chunks; i++)
+        offsets[i + 1] = offsets[i] + chunks[i].size();
+
+    std::vector<FastaRecord> records(offsets.back());
+
+#pragma omp parallel for schedule(static, 1)
+    for (size_t i = 0; i < n_chunks; i++)
+        std::ranges::copy(chunks[i], records.begin() + static_cast<std::ptrdiff_t>(offsets[i]));
+
+    return records;
+}
+
+FastaFile read_fasta(const std::filesystem::path &filename)
+{
+    FastaFile fasta{map_decompressed(filename), {}};
+
+    char *data = fasta.file.getData();
+    const size_t size = fasta.file.getSize();
+
+    if (size == 0 || *data != '>')
+        exit("Not a fasta file: " + filename.native());
+
+    fasta.records = parse_range(data, data + size);
+
+    return fasta;
+}
+
+int parse_set_id(std::string_view header)
+{
+    if (header.starts_with("set"))
+        header.remove_prefix(3);
+
+    while (!header.empty() && std::isspace(static_cast<unsigned char>(header.front())))
+        header.remove_prefix(1);
+
+    int id = 0;
+    auto [ptr, ec] = std::from_chars(header.data(), header.data() + header.size(), id);
+    if (ec != std::errc{})
+        exit("Invalid set header: " + std::string(header));
+
+    return id;
+}
+
+/// Returns the index of the first record of each run of records with the same set id, plus the number of records
+static std::vector<uint64_t> contiguous_sets(std::span<const FastaRecord> records)
+{
+    std::vector<uint64_t> set_offsets;
+    int current_id = 0;
+
+    for (size_t i = 0; i < records.size(); i++)
     {
-        if (munmap(data, size) == -1)
+        auto id = parse_set_id(records[i].header);
+        if (set_offsets.empty() || id != current_id)
         {
-            perror("Error unmapping file");
-            exit(EXIT_FAILURE);
+            current_id = id;
+            set_offsets.push_back(i);
         }
     }
+    set_offsets.push_back(records.size());
+
+    return set_offsets;
+}
 
-    inline const char *getData() const { return data; }
-    inline size_t getSize() const { return size; }
+/**
+ * @brief A set found while grouping records
+ *
+ */
+struct SetGroup
+{
+    /// @brief Set description
+    uint64_t first;                /// index of the first record of the set in the file
+    std::vector<uint64_t> members; /// indexes of the records of the set, in file order
 };
 
-std::vector<std::string> split_lines(const char *mapped_file, size_t file_size)
+static inline size_t partition_of(int id, size_t n_partitions)
 {
-    std::vector<std::string> lines;
-    const char *start = mapped_file;
-    const char *end = mapped_file + file_size;
-    while (start < end)
-    {
-        const char *line_end = std::find(start, end, '\n');
-        lines.emplace_back(start, line_end);
-        start = line_end + 1;
-    }
-    return lines;
+    return (static_cast<uint32_t>(id) * 2654435761U) % n_partitions;
 }
 
-static inline std::vector<std::string> check_lines_number(const std::vector<std::string> &lines)
+/// Groups records by set id, sets are ordered by their first record and records of a set keep the file order.
+/// Records are hash partitioned by set id, then each partition is grouped independently.
+/// Returns the index of the first record of each set, plus the number of records.
+static std::vector<uint64_t> group_sets(std::vector<FastaRecord> &records)
 {
-    if ((lines.size() & 1) == 1)
-        exit("Lines are odd: " + std::to_string(lines.size()));
+    const auto n = records.size();
+    const auto n_chunks = static_cast<size_t>(omp_get_max_threads());
+    const auto n_partitions = n_chunks * 4;
 
-    if (lines.size() < 2)
-        exit(std::to_string(lines.size()) + " line !!!");
+    std::vector<int> ids(n);
+    std::vector<size_t> counts(n_chunks * n_partitions, 0);
 
-    return lines;
-}
+    // 1) parse ids and count records per chunk and partition
+#pragma omp parallel for schedule(static, 1)
+    for (size_t c = 0; c < n_chunks; c++)
+        for (size_t i = n * c / n_chunks; i < n * (c + 1) / n_chunks; i++)
+        {
+            ids[i] = parse_set_id(records[i].header);
+            counts[c * n_partitions + partition_of(ids[i], n_partitions)]++;
+        }
 
-static inline Sets lines_to_sets(const std::vector<std::string> &lines)
-{
-    Sets sets(1);
+    // 2) scatter record indexes to their partition, chunks in order so records stay in file order
+    std::vector<size_t> partition_offsets(n_partitions + 1, 0);
+    std::vector<size_t> cursors(n_chunks * n_partitions);
+    for (size_t p = 0, offset = 0; p < n_partitions; p++)
+    {
+        partition_offsets[p] = offset;
+        for (size_t c = 0; c < n_chunks; c++)
+        {
+            cursors[c * n_partitions + p] = offset;
+            offset += counts[c * n_partitions + p];
+        }
+    }
+    partition_offsets[n_partitions] = n;
 
-    auto current_id = std::stoi(std::string(lines[0].begin() + 4, lines[0].end()));
-    for (size_t i = 0; i < lines.size(); i += 2)
+    std::vector<uint64_t> partitioned(n);
+
+#pragma omp parallel for schedule(static, 1)
+    for (size_t c = 0; c < n_chunks; c++)
+        for (size_t i = n * c / n_chunks; i < n * (c + 1) / n_chunks; i++)
+            partitioned[cursors[c * n_partitions + partition_of(ids[i], n_partitions)]++] = i;
+
+    // 3) group each partition by id
+    std::vector<std::vector<SetGroup>> groups(n_partitions);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (size_t p = 0; p < n_partitions; p++)
     {
-        auto id = std::stoi(std::string(lines[i].begin() + 4, lines[i].end()));
-        if (id != current_id)
+        std::unordered_map<int, size_t> set_index;
+        for (size_t k = partition_offsets[p]; k < partition_offsets[p + 1]; k++)
         {
-            current_id = id;
-            sets.resize(sets.size() + 1);
+            const auto i = partitioned[k];
+            auto [it, inserted] = set_index.try_emplace(ids[i], groups[p].size());
+            if (inserted)
+                groups[p].push_back({i, {}});
+            groups[p][it->second].members.push_back(i);
         }
-        sets.back().push_back(lines[i + 1]);
     }
 
-    return sets;
+    // 4) order sets by first record and write records in set order
+    std::vector<const SetGroup *> sets;
+    for (const auto &partition : groups)
+        for (const auto &set : partition)
+            sets.push_back(&set);
+
+    std::ranges::sort(sets, {}, &SetGroup::first);
+
+    std::vector<uint64_t> set_offsets(sets.size() + 1, 0);
+    for (size_t s = 0; s < sets.size(); s++)
+        set_offsets[s + 1] = set_offsets[s] + sets[s]->members.size();
+
+    std::vector<FastaRecord> grouped(n);
+
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (size_t s = 0; s < sets.size(); s++)
+        for (size_t m = 0; m < sets[s]->members.size(); m++)
+            grouped[set_offsets[s] + m] = records[sets[s]->members[m]];
+
+    records = std::move(grouped);
+
+    return set_offsets;
+}
+
+/// Packs all records in a store, set_offsets gives the set boundaries in record indexes
+static SequenceStore records_to_store(std::span<const FastaRecord> records, std::vector<uint64_t> set_offsets)
+{
+    SequenceBuffers store;
+    store.set_offsets = std::move(set_offsets);
+    store.lengths.resize(records.size());
+    store.offsets.resize(records.size());
+
+    uint64_t offset = 0;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        store.lengths[i] = static_cast<uint32_t>(records[i].sequence.size());
+        store.offsets[i] = offset;
+        offset += compressed_size(records[i].sequence.size());
+    }
+
+    store.data.resize(offset);
+
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (size_t i = 0; i < records.size(); i++)
+        pack_sequence(records[i].sequence, store.data.data() + store.offsets[i]);
+
+    return SequenceStore(std::move(store));
+}
+
+SequenceStore read_set_fasta(const std::filesystem::path &filename)
+{
+    auto fasta = read_fasta(filename);
+    auto set_offsets = group_sets(fasta.records);
+
+    return records_to_store(fasta.records, std::move(set_offsets));
 }
 
-static inline Set lines_to_sequences(const std::vector<std::string> &lines)
+SequenceStore read_seq_fasta(const std::filesystem::path &filename)
 {
-    Set set(lines.size() / 2);
+    const auto fasta = read_fasta(filename);
+
+    return records_to_store(fasta.records, {0, fasta.records.size()});
+}
 
-    for (size_t i = 0; i < lines.size(); i += 2)
-        set[i / 2] = lines[i + 1];
+FastaSetStream::FastaSetStream(const std::filesystem::path &filename, size_t bytes, size_t max_sets)
+    : file(filename), window_bytes(std::max(bytes, size_t{1})), remaining_sets(max_sets)
+{
+    if (is_gzip(file))
+    {
+        gzip = std::make_unique<GzipReader>(std::move(file));
+        gzip->read(buffer, window_bytes);
+        text_begin = buffer.data();
+        text_end = text_begin + buffer.size();
+    }
+    else
+    {
+        text_begin = file.getData();
+        text_end = text_begin + file.getSize();
+    }
+    position = text_begin;
 
-    return set;
+    if (text_begin == text_end || *position != '>')
+        exit("Not a fasta file: " + filename.native());
 }
 
-std::vector<std::string> read_raw_sequence_file(const std::filesystem::path &filename)
+bool FastaSetStream::at_end() const
 {
-    MappedFile mappedFile(filename);
-    return split_lines(mappedFile.getData(), mappedFile.getSize());
+    return position == text_end && (gzip == nullptr || gzip->eof());
 }
 
-Sets read_set_fasta(const std::filesystem::path &filename)
+void FastaSetStream::refill(std::vector<FastaRecord> &records)
 {
-    std::vector<std::string> lines = read_raw_sequence_file(filename);
-    check_lines_number(lines);
-    return lines_to_sets(lines);
+    // the records and everything after them are kept, they are all in the buffer
+    const char *keep = records.empty() ? position : records.front().header.data() - 1;
+    const auto kept = static_cast<size_t>(text_end - keep);
+
+    std::memmove(buffer.data(), keep, kept);
+    buffer.resize(kept);
+    gzip->read(buffer, window_bytes);
+
+    const auto delta = buffer.data() - keep;
+    for (auto &r : records)
+        r = {{r.header.data() + delta, r.header.size()}, {r.sequence.data() + delta, r.sequence.size()}};
+
+    position += delta;
+    text_begin = buffer.data();
+    text_end = text_begin + buffer.size();
 }
 
-Set read_seq_fasta(const std::filesystem::path &filename)
+std::optional<SequenceStore> FastaSetStream::next()
 {
-    std::vector<std::string> lines = read_raw_sequence_file(filename);
-    check_lines_number(lines);
-    return lines_to_sequences(lines);
-}
\ No newline at end of file
+    if (remaining_sets == 0 || (at_end() && carry.empty()))
+        return std::nullopt;
+
+    auto records = std::move(carry);
+    carry.clear();
+
+    // Parse until the window holds at least one complete set, the last set is only
+    // complete at the end of file as it may continue in the next chunk.
+    std::vector<uint64_t> set_offsets;
+    while (true)
+    {
+        char *stop = next_record(text_begin, std::min(position + window_bytes, text_end), text_end);
+
+        // compressed text is parsed up to a complete record only, the last one may be cut
+        if (gzip != nullptr && stop == text_end && !gzip->eof())
+        {
+            refill(records);
+            continue;
+        }
+
+        auto parsed = parse_range(position, stop);
+        records.insert(records.end(), parsed.begin(), parsed.end());
+        position = stop;
+
+        set_offsets = contiguous_sets(records);
+        if (at_end() || set_offsets.size() > 2)
+            break;
+    }
+
+    if (!at_end())
+    {
+        carry.assign(records.begin() + static_cast<std::ptrdiff_t>(set_offsets[set_offsets.size() - 2]), records.end());
+        set_offsets.pop_back();
+    }
+
+    if (set_offsets.size() - 1 > remaining_sets)
+    {
+        set_offsets.resize(remaining_sets + 1);
+        carry.clear();
+    }
+    remaining_sets -= set_offsets.size() - 1;
+
+    // a set already streamed, in this window or any previous one, is not contiguous
+    for (size_t s = 0; s + 1 < set_offsets.size(); s++)
+    {
+        const auto id = parse_set_id(records[set_offsets[s]].header);
+
+        // one bit per id, negative ids interleaved with the positive ones
+        const auto bit = id >= 0 ? 2 * static_cast<size_t>(id) : 2 * static_cast<size_t>(-static_cast<int64_t>(id)) - 1;
+        if (bit >= streamed_ids.size())
+            streamed_ids.resize(std::max(bit + 1, 2 * streamed_ids.size()));
+        if (streamed_ids[bit])
+            exit("Sequences of a set are not contiguous, they can not be streamed. "
+                 "Use a dataset cache written by dpu_convert -s instead.");
+        streamed_ids[bit] = true;
+    }
+
+    const auto n_records = set_offsets.back();
+    auto store = records_to_store(std::span(records).first(n_records), std::move(set_offsets));
+
+    // everything before the carried records has been packed, the buffer of a compressed file is trimmed by its next refill
+    if (gzip == nullptr)
+        file.release(records.front().header.data() - 1, carry.empty() ? position : carry.front().header.data() - 1);
+
+    return store;
+}
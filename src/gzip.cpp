@@ -0,0 +1,304 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+
+#include "gzip.hpp"
+#include "types.hpp"
+
+static constexpr size_t gzip_header_size = 12; // fixed part of a gzip header with FEXTRA
+static constexpr size_t gzip_footer_size = 8;  // CRC32 and ISIZE
+static constexpr uint8_t gzip_fextra = 0x04;
+static constexpr size_t zlib_max_chunk = 1LU << 30; // zlib sizes are 32 bits
+
+template <typename T>
+static T read_le(const uint8_t *p)
+{
+    T v;
+    std::memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+bool is_gzip(const MappedFile &file)
+{
+    const auto *p = reinterpret_cast<const uint8_t *>(file.getData());
+    return file.getSize() >= 2 && p[0] == 0x1f && p[1] == 0x8b;
+}
+
+/// Returns the total size of the BGZF block at p, 0 if it is not a BGZF block
+static size_t bgzf_block_size(const uint8_t *p, size_t available)
+{
+    if (available < gzip_header_size + gzip_footer_size || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || (p[3] & gzip_fextra) == 0)
+        return 0;
+
+    const size_t xlen = read_le<uint16_t>(p + 10);
+    if (gzip_header_size + xlen > available)
+        return 0;
+
+    // look for the 'BC' subfield holding the block size
+    const uint8_t *extra = p + gzip_header_size;
+    for (size_t i = 0; i + 4 <= xlen;)
+    {
+        const size_t slen = read_le<uint16_t>(extra + i + 2);
+        if (extra[i] == 'B' && extra[i + 1] == 'C' && slen == 2 && i + 6 <= xlen)
+        {
+            const size_t bsize = read_le<uint16_t>(extra + i + 4) + 1LU;
+            return bsize <= available && bsize >= gzip_header_size + xlen + gzip_footer_size ? bsize : 0;
+        }
+        i += 4 + slen;
+    }
+
+    return 0;
+}
+
+/// Returns the list of blocks if the whole file is made of BGZF blocks, an empty list otherwise
+std::vector<BgzfBlock> bgzf_blocks(const MappedFile &file)
+{
+    const auto *data = reinterpret_cast<const uint8_t *>(file.getData());
+    const auto size = file.getSize();
+
+    std::vector<BgzfBlock> blocks;
+    size_t inflated_offset = 0;
+
+    for (size_t pos = 0; pos < size;)
+    {
+        const auto block_size = bgzf_block_size(data + pos, size - pos);
+        if (block_size == 0)
+            return {};
+
+        const auto header_size = gzip_header_size + read_le<uint16_t>(data + pos + 10);
+        const auto *footer = data + pos + block_size - gzip_footer_size;
+
+        BgzfBlock block{pos + header_size,
+                        block_size - header_size - gzip_footer_size,
+                        read_le<uint32_t>(footer),
+                        read_le<uint32_t>(footer + 4),
+                        inflated_offset};
+        inflated_offset += block.inflated_size;
+        blocks.push_back(block);
+
+        pos += block_size;
+    }
+
+    return blocks;
+}
+
+/// Inflates a block to out and checks its CRC32
+static bool inflate_block(const uint8_t *data, const BgzfBlock &block, uint8_t *out)
+{
+    z_stream stream{};
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+        return false;
+
+    stream.next_in = const_cast<uint8_t *>(data + block.deflate_offset);
+    stream.avail_in = static_cast<uInt>(block.deflate_size);
+    stream.next_out = out;
+    stream.avail_out = block.inflated_size;
+
+    const auto ret = inflate(&stream, Z_FINISH);
+    const bool valid = ret == Z_STREAM_END && stream.total_out == block.inflated_size;
+    inflateEnd(&stream);
+
+    return valid && crc32(0, out, block.inflated_size) == block.crc;
+}
+
+static MappedFile inflate_bgzf(const MappedFile &file, const std::vector<BgzfBlock> &blocks)
+{
+    const auto *data = reinterpret_cast<const uint8_t *>(file.getData());
+    auto output = MappedFile::anonymous(blocks.back().inflated_offset + blocks.back().inflated_size);
+    auto *out = reinterpret_cast<uint8_t *>(output.getData());
+
+    bool valid = true;
+
+#pragma omp parallel for schedule(dynamic, 64) reduction(&& : valid)
+    for (size_t i = 0; i < blocks.size(); i++)
+        valid = inflate_block(data, blocks[i], out + blocks[i].inflated_offset) && valid;
+
+    if (!valid)
+        exit("Corrupted BGZF file");
+
+    return output;
+}
+
+static MappedFile inflate_gzip(const MappedFile &file)
+{
+    const auto *data = reinterpret_cast<const uint8_t *>(file.getData());
+    const auto size = file.getSize();
+
+    z_stream stream{};
+    if (inflateInit2(&stream, MAX_WBITS + 16) != Z_OK)
+        exit("Can not initialize zlib");
+
+    // the uncompressed size is unknown, the output grows as needed
+    auto output = MappedFile::anonymous(std::max(size * 4, size_t{1} << 20));
+    size_t consumed = 0;
+    size_t produced = 0;
+    stream.next_in = const_cast<uint8_t *>(data);
+
+    while (true)
+    {
+        if (produced == output.getSize())
+            output.resize(output.getSize() * 2);
+
+        stream.avail_in = static_cast<uInt>(std::min(size - consumed, zlib_max_chunk));
+        stream.next_out = reinterpret_cast<uint8_t *>(output.getData()) + produced;
+        stream.avail_out = static_cast<uInt>(std::min(output.getSize() - produced, zlib_max_chunk));
+
+        const auto ret = inflate(&stream, Z_NO_FLUSH);
+        consumed = static_cast<size_t>(stream.next_in - data);
+        produced = static_cast<size_t>(stream.next_out - reinterpret_cast<uint8_t *>(output.getData()));
+
+        if (ret == Z_STREAM_END)
+        {
+            // concatenated gzip members are decompressed one after the other
+            if (size - consumed >= 2 && data[consumed] == 0x1f && data[consumed + 1] == 0x8b)
+            {
+                inflateReset(&stream);
+                continue;
+            }
+            break;
+        }
+
+        if (ret == Z_BUF_ERROR && consumed == size)
+            exit("Truncated gzip file");
+
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            exit(std::string("Corrupted gzip file: ") + (stream.msg != nullptr ? stream.msg : "unknown error"));
+    }
+
+    inflateEnd(&stream);
+    output.resize(produced);
+
+    return output;
+}
+
+MappedFile gunzip(const MappedFile &file)
+{
+    const auto blocks = bgzf_blocks(file);
+
+    if (!blocks.empty())
+        return inflate_bgzf(file, blocks);
+
+    return inflate_gzip(file);
+}
+
+GzipReader::GzipReader(MappedFile &&f) : file(std::move(f)), blocks(bgzf_blocks(file))
+{
+    if (!blocks.empty())
+        return;
+
+    if (inflateInit2(&stream, MAX_WBITS + 16) != Z_OK)
+        exit("Can not initialize zlib");
+    stream_open = true;
+    stream.next_in = reinterpret_cast<uint8_t *>(file.getData());
+}
+
+GzipReader::~GzipReader()
+{
+    if (stream_open)
+        inflateEnd(&stream);
+}
+
+size_t GzipReader::read(std::vector<char> &out, size_t n)
+{
+    const auto first = out.size();
+    n = std::max(n, size_t{1});
+
+    if (!blocks.empty())
+        read_blocks(out, n);
+    else
+        read_stream(out, n);
+
+    return out.size() - first;
+}
+
+void GzipReader::read_blocks(std::vector<char> &out, size_t n)
+{
+    const auto *data = reinterpret_cast<const uint8_t *>(file.getData());
+    const auto first = next_block;
+    const auto start = out.size();
+
+    // whole blocks, at least one, until n bytes are inflated
+    size_t inflated = 0;
+    while (next_block < blocks.size() && (next_block == first || inflated < n))
+        inflated += blocks[next_block++].inflated_size;
+
+    if (next_block == first)
+        return;
+
+    out.resize(start + inflated);
+    auto *output = reinterpret_cast<uint8_t *>(out.data() + start);
+    const auto base = blocks[first].inflated_offset;
+
+    bool valid = true;
+
+#pragma omp parallel for schedule(dynamic, 64) reduction(&& : valid)
+    for (size_t i = first; i < next_block; i++)
+        valid = inflate_block(data, blocks[i], output + (blocks[i].inflated_offset - base)) && valid;
+
+    if (!valid)
+        exit("Corrupted BGZF file");
+
+    const auto &last = blocks[next_block - 1];
+    file.release(file.getData(), file.getData() + last.deflate_offset + last.deflate_size);
+}
+
+void GzipReader::read_stream(std::vector<char> &out, size_t n)
+{
+    const auto *data = reinterpret_cast<const uint8_t *>(file.getData());
+    const auto size = file.getSize();
+    const auto start = out.size();
+
+    out.resize(start + n);
+    size_t produced = 0;
+
+    while (!done && produced < n)
+    {
+        const auto consumed = static_cast<size_t>(stream.next_in - data);
+        stream.avail_in = static_cast<uInt>(std::min(size - consumed, zlib_max_chunk));
+        stream.next_out = reinterpret_cast<uint8_t *>(out.data() + start + produced);
+        stream.avail_out = static_cast<uInt>(std::min(n - produced, zlib_max_chunk));
+
+        const auto ret = inflate(&stream, Z_NO_FLUSH);
+        const auto read = static_cast<size_t>(stream.next_in - data);
+        produced = static_cast<size_t>(stream.next_out - reinterpret_cast<uint8_t *>(out.data() + start));
+
+        if (ret == Z_STREAM_END)
+        {
+            // concatenated gzip members are decompressed one after the other
+            if (size - read >= 2 && data[read] == 0x1f && data[read + 1] == 0x8b)
+                inflateReset(&stream);
+            else
+                done = true;
+            continue;
+        }
+
+        if (ret == Z_BUF_ERROR && read == size)
+            exit("Truncated gzip file");
+
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            exit(std::string("Corrupted gzip file: ") + (stream.msg != nullptr ? stream.msg : "unknown error"));
+    }
+
+    out.resize(start + produced);
+    file.release(file.getData(), reinterpret_cast<const char *>(stream.next_in));
+}
+
+bool GzipReader::eof() const
+{
+    return blocks.empty() ? done : next_block == blocks.size();
+}
+
+MappedFile map_decompressed(const std::filesystem::path &filename)
+{
+    MappedFile file(filename);
+
+    if (!is_gzip(file))
+        return file;
+
+    return gunzip(file);
+}
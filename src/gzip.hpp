@@ -0,0 +1,105 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#ifndef E3AD4ABB_01D5_406F_A530_9E0B60B9F151
+#define E3AD4ABB_01D5_406F_A530_9E0B60B9F151
+
+#include <filesystem>
+#include <vector>
+#include <zlib.h>
+
+#include "mapped_file.hpp"
+
+/**
+ * @brief Location of a BGZF block in the compressed file
+ *
+ */
+struct BgzfBlock
+{
+    /// @brief Block description
+    size_t deflate_offset;  /// offset of the raw deflate data
+    size_t deflate_size;    /// size of the raw deflate data
+    uint32_t crc;           /// CRC32 of the uncompressed data
+    uint32_t inflated_size; /// size of the uncompressed data
+    size_t inflated_offset; /// offset of the uncompressed data in the whole file
+};
+
+/**
+ * @brief Returns true if the mapped file starts with the gzip magic number
+ *
+ * @param file
+ */
+bool is_gzip(const MappedFile &file);
+
+/**
+ * @brief Decompresses a gzip file into an anonymous mapping.
+ * BGZF files (blocked gzip, as written by bgzip) are decompressed in parallel,
+ * one block per task. Other gzip files, possibly made of several members,
+ * are decompressed sequentially.
+ *
+ * @param file
+ * @return Decompressed content
+ */
+MappedFile gunzip(const MappedFile &file);
+
+/**
+ * @brief Returns the list of blocks if the whole file is made of BGZF blocks, an empty list otherwise
+ *
+ * @param file
+ */
+std::vector<BgzfBlock> bgzf_blocks(const MappedFile &file);
+
+/**
+ * @brief Decompresses a gzip file chunk by chunk, to bound memory when it is read sequentially.
+ * The blocks of a BGZF file are inflated in parallel within a chunk, other gzip files are
+ * inflated sequentially. Pages of the compressed file are released once inflated.
+ *
+ */
+class GzipReader
+{
+    MappedFile file;
+    std::vector<BgzfBlock> blocks; /// empty if the file is not BGZF
+    size_t next_block = 0;         /// first BGZF block not inflated
+    z_stream stream{};             /// inflater of a file that is not BGZF
+    bool stream_open = false;
+    bool done = false; /// end of the last gzip member reached
+
+    void read_blocks(std::vector<char> &out, size_t n);
+    void read_stream(std::vector<char> &out, size_t n);
+
+public:
+    /**
+     * @brief Takes a mapped gzip file, nothing is inflated yet
+     *
+     * @param file
+     */
+    explicit GzipReader(MappedFile &&file);
+    ~GzipReader();
+
+    GzipReader(const GzipReader &) = delete;
+    GzipReader &operator=(const GzipReader &) = delete;
+
+    /**
+     * @brief Appends the next n bytes of the decompressed content to out, less at the end of the file.
+     * BGZF files are inflated by whole blocks, so up to a block more can be appended.
+     *
+     * @param out
+     * @param n
+     * @return size_t number of bytes appended
+     */
+    size_t read(std::vector<char> &out, size_t n);
+
+    /// @brief Returns true once the whole content was read
+    bool eof() const;
+};
+
+/**
+ * @brief Maps a file, gzip and BGZF files are transparently decompressed in memory
+ *
+ * @param filename
+ * @return Mapped content
+ */
+MappedFile map_decompressed(const std::filesystem::path &filename);
+
+#endif /* E3AD4ABB_01D5_406F_A530_9E0B60B9F151 */
@@ -6,8 +6,9 @@
 #include <yaml-cpp/yaml.h>
 
 #include "../libnwdpu/host/dpu_common.hpp"
-#include "fasta.hpp"
-#include "../timeline.hpp"
+#include "cxxopts.hpp"
+#include "dataset_cache.hpp"
+#include "timeline.hpp"
 
 auto read_parameters(const std::filesystem::path &filename)
 {
@@ -15,6 +16,19 @@ auto read_parameters(const std::filesystem::path &filename)
     auto dataset = config["dataset"].as<std::string>();
     auto ranks = config["ranks"].as<uint32_t>();
     auto params = config["nw_params"];
+    auto output = config["output"] ? config["output"].as<std::string>() : std::string("scores.nwsm");
+    auto output_type = config["output_type"] ? config["output_type"].as<std::string>() : std::string("int32");
+    auto jobs = config["jobs_per_launch"] ? config["jobs_per_launch"].as<uint32_t>() : 8U;
+    auto queries = config["queries"] ? config["queries"].as<std::string>() : std::string{};
+    auto hits = config["hits"] ? config["hits"].as<std::string>() : std::string("hits.txt");
+    auto shard = config["shard"] ? config["shard"].as<uint32_t>() : 0U;
+    auto shards = config["shards"] ? config["shards"].as<uint32_t>() : 1U;
+
+    if (output_type != "int32" && output_type != "int16")
+        exit("Unknown output_type " + output_type + ", expected int32 or int16");
+
+    if (jobs == 0 || jobs > SCORE_MAILBOX_MAX_JOBS)
+        exit("jobs_per_launch must be between 1 and " + std::to_string(SCORE_MAILBOX_MAX_JOBS));
 
     const auto home = std::filesystem::canonical("/proc/self/exe").parent_path();
 
@@ -25,33 +39,123 @@ auto read_parameters(const std::filesystem::path &filename)
                      params["gap_opening"].as<int32_t>(),
                      params["gap_extension"].as<int32_t>(),
                      128},
-        ranks};
+        ranks,
+        std::filesystem::path(output),
+        output_type == "int16" ? ScoreType::Int16 : ScoreType::Int32,
+        jobs,
+        queries.empty() ? std::filesystem::path{} : home / queries,
+        std::filesystem::path(hits),
+        shard,
+        shards};
 }
 
-int main()
+/**
+ * @brief Path of the score matrix of a shard: the output path with the shard index before its extension
+ *
+ */
+std::filesystem::path shard_path(std::filesystem::path output, uint32_t shard)
 {
-    auto [dataset_path, params, ranks] = read_parameters("./16s.yaml");
+    const auto extension = output.extension();
+    output.replace_extension();
+    output += ".shard" + std::to_string(shard);
+    output += extension;
+    return output;
+}
+
+/**
+ * @brief Searches the queries in the dataset, the best hit of each query is written to a text file:
+ * one line per query, its index, the index of its best hit in the dataset and their score
+ *
+ */
+void search(const SequenceStore &database, const std::filesystem::path &queries_path, const std::filesystem::path &hits_path, const NwParameters &params, uint32_t ranks)
+{
+    printf("Queries:\n");
+    auto queries = load_seq_dataset(queries_path) |
+                   print_size<SequenceStore>("  size: ");
+
+    SearchHits hits(queries.size());
+    dpu_search_pipeline("./libnwdpu/dpu/nw_16s", params, ranks, database, queries, hits);
+
+    std::ofstream file(hits_path);
+    if (!file)
+        exit("Can not write " + hits_path.native());
+    for (size_t q = 0; q < hits.hits.size(); q++)
+        file << q << '\t' << hits.hits[q].target << '\t' << hits.hits[q].score << '\n';
+
+    printf("Wrote the best hits of %lu queries to %s\n", queries.size(), hits_path.c_str());
+}
+
+int main(int argc, char **argv)
+{
+    cxxopts::Options options("dpu_16S", "Needleman-Wunsch all against all of a dataset, parameters are read from 16s.yaml");
+    options.add_options()(
+        "s,shard", "Index of the shard computed, supersedes shard of 16s.yaml", cxxopts::value<uint32_t>())(
+        "k,shards", "Number of shards the score matrix is split in, supersedes shards of 16s.yaml", cxxopts::value<uint32_t>());
+    options.add_options()("h,help", "Print usage");
+
+    auto result = options.parse(argc, argv);
+    if (result.count("help"))
+    {
+        printf("%s\n", options.help().c_str());
+        return 0;
+    }
+
+    auto [dataset_path, params, ranks, output_path, output_type, jobs_per_launch, queries_path, hits_path, shard, shards] = read_parameters("./16s.yaml");
+    if (result.count("shard"))
+        shard = result["shard"].as<uint32_t>();
+    if (result.count("shards"))
+        shards = result["shards"].as<uint32_t>();
+    if (shards == 0 || shard >= shards)
+        exit("Shard " + std::to_string(shard) + " out of " + std::to_string(shards) + " shards");
+
     Timeline timeline{"sets_time.csv"};
 
     printf("DPU mode:\n"
            "  forcing width to 128.\n"
-           "  using %u ranks.\n\n",
-           ranks);
+           "  using %u ranks.\n"
+           "  %u jobs per launch.\n\n",
+           ranks, jobs_per_launch);
     params.Print();
 
     printf("Dataset:\n");
-    auto dataset = read_seq_fasta(dataset_path) |
-                   print_size<Set>("  size: ") |
-                   encode<Set>;
+    auto dataset = load_seq_dataset(dataset_path) |
+                   print_size<SequenceStore>("  size: ");
+
+    if (!queries_path.empty())
+    {
+        if (shards > 1)
+            exit("A search is not sharded, remove shards from 16s.yaml");
+
+        timeline.mark("Initialization");
+        Timer compute_time{};
+        search(dataset, queries_path, hits_path, params, ranks);
+        compute_time.Print("  ");
+        timeline.mark("Alignement");
+        return 0;
+    }
+
+    // a shard computes a contiguous range of rows of about the same load as the others, merged by dpu_merge
+    std::optional<ScoreShard> rows{};
+    if (shards > 1)
+    {
+        rows = score_shard(dataset.lengths, shard, shards);
+        output_path = shard_path(output_path, shard);
+    }
+
+    printf("Output:\n"
+           "  %s, %s scores\n",
+           output_path.c_str(), output_type == ScoreType::Int16 ? "int16" : "int32");
+    if (rows)
+        printf("  shard %u of %u: rows %lu to %lu\n", shard, shards, rows->first_row, rows->last_row);
+    printf("\n");
+    auto scores = ScoreMatrix::create(output_path, dataset.size(), output_type, params, dataset_fingerprint(dataset), rows);
 
     timeline.mark("Initialization");
     Timer compute_time{};
-    auto alignments = dpu_16s_pipeline("./libnwdpu/dpu/nw_16s", params, ranks, dataset);
+    dpu_16s_pipeline("./libnwdpu/dpu/nw_16s", params, ranks, dataset, scores, jobs_per_launch, rows);
+    scores.finish();
     compute_time.Print("  ");
     timeline.mark("Alignement");
 
-    dump_to_file("scores.txt", alignments, [](const auto &e)
-                 { return e; });
-
     return 0;
 }
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include "cxxopts.hpp"
+#include "dataset_cache.hpp"
+#include "fasta.hpp"
+#include "pack.hpp"
+
+int main(int argc, char **argv)
+{
+    cxxopts::Options options("dpu_convert", "Converts a fasta dataset into a pre-encoded, memory mappable, dataset cache");
+    options.add_options()(
+        "i,input", "Path to the fasta file", cxxopts::value<std::string>())(
+        "o,output", "Path to the dataset cache to write", cxxopts::value<std::string>())(
+        "s,sets", "Group sequences by set id, for dpu_sets datasets (default: single collection, for dpu_16S)");
+
+    options.add_options()("h,help", "Print usage");
+
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help") || !result.count("input") || !result.count("output"))
+    {
+        printf("%s\n", options.help().c_str());
+        return 0;
+    }
+
+    const auto input = result["input"].as<std::string>();
+    const auto output = result["output"].as<std::string>();
+    const auto kind = result.count("sets") ? DatasetKind::Sets : DatasetKind::Sequences;
+
+    printf("Dataset:\n"
+           "  encoder:   %s\n",
+           pack_kernel_name());
+    Timer load_time{};
+    auto dataset = kind == DatasetKind::Sets ? read_set_fasta(input) : read_seq_fasta(input);
+    printf("  sets:      %lu\n"
+           "  sequences: %lu\n"
+           "  packed:    %lu bytes\n",
+           dataset.number_of_sets(), dataset.size(), dataset.data.size());
+    load_time.Print("  ");
+
+    printf("Writing %s\n", output.c_str());
+    Timer write_time{};
+    write_dataset_cache(dataset, kind, output);
+    write_time.Print("  ");
+
+    return 0;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include "cxxopts.hpp"
+#include "score_matrix.hpp"
+
+int main(int argc, char **argv)
+{
+    cxxopts::Options options("dpu_merge", "Merges the shards of a score matrix written by dpu_16S runs");
+    options.add_options()(
+        "o,output", "Path to the merged score matrix", cxxopts::value<std::string>())(
+        "shards", "Score matrix shards", cxxopts::value<std::vector<std::string>>());
+
+    options.add_options()("h,help", "Print usage");
+    options.parse_positional({"shards"});
+    options.positional_help("shard.nwsm...");
+
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help") || !result.count("output") || !result.count("shards"))
+    {
+        printf("%s\n", options.help().c_str());
+        return 0;
+    }
+
+    std::vector<ScoreMatrix> shards;
+    for (const auto &path : result["shards"].as<std::vector<std::string>>())
+        shards.push_back(ScoreMatrix::open(path));
+
+    const auto merged = merge_shards(result["output"].as<std::string>(), shards);
+
+    printf("Merged %lu shards: %lu sequences, %lu scores written to %s\n",
+           shards.size(), merged.size(), merged.info().number_of_scores, result["output"].as<std::string>().c_str());
+
+    return 0;
+}
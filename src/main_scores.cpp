@@ -0,0 +1,90 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include "cxxopts.hpp"
+#include "score_matrix.hpp"
+
+static void check_index(const ScoreMatrix &scores, size_t i)
+{
+    if (i >= scores.size())
+        exit("Sequence index " + std::to_string(i) + " out of range, matrix size is " + std::to_string(scores.size()));
+}
+
+int main(int argc, char **argv)
+{
+    cxxopts::Options options("dpu_scores", "Queries a score matrix written by dpu_16S");
+    options.add_options()(
+        "i,input", "Path to the score matrix", cxxopts::value<std::string>())(
+        "p,pairs", "Print the scores of pairs of sequences, given as i,j or i,j,k,l,...", cxxopts::value<std::vector<size_t>>())(
+        "r,row", "Print the scores of a sequence against all the others", cxxopts::value<size_t>())(
+        "t,text", "Write all scores to a text file, one per line in triangular order", cxxopts::value<std::string>());
+
+    options.add_options()("h,help", "Print usage");
+
+    auto result = options.parse(argc, argv);
+
+    if (result.count("help") || !result.count("input"))
+    {
+        printf("%s\n", options.help().c_str());
+        return 0;
+    }
+
+    const auto scores = ScoreMatrix::open(result["input"].as<std::string>());
+    const auto &info = scores.info();
+
+    printf("Score matrix:\n"
+           "  sequences: %lu\n"
+           "  scores:    %lu (%s)\n"
+           "  params:    match %d, mismatch %d, gap opening %d, gap extension %d\n",
+           info.size, info.number_of_scores, info.type == ScoreType::Int16 ? "int16" : "int32",
+           info.match, info.mismatch, info.gap_opening, info.gap_extension);
+
+    if (info.fingerprint != 0)
+        printf("  dataset:   fingerprint %016lx\n", info.fingerprint);
+    if (info.number_of_scores != sum_integers(info.size))
+        printf("  shard:     scores %lu to %lu of %lu, merge the shards with dpu_merge\n",
+               info.first_score, info.first_score + info.number_of_scores, sum_integers(info.size));
+    if (info.complete == 0)
+        printf("  incomplete: the run writing it did not finish\n");
+
+    if (result.count("pairs"))
+    {
+        const auto pairs = result["pairs"].as<std::vector<size_t>>();
+        if (pairs.size() % 2 != 0)
+            exit("Pairs must be given as i,j");
+
+        for (size_t k = 0; k < pairs.size(); k += 2)
+        {
+            const auto i = pairs[k];
+            const auto j = pairs[k + 1];
+            check_index(scores, i);
+            check_index(scores, j);
+            if (i == j)
+                exit("A sequence is not aligned with itself: " + std::to_string(i));
+            if (!scores.contains(triangular_index(std::min(i, j), std::max(i, j), scores.size())))
+                exit("Pair " + std::to_string(i) + "," + std::to_string(j) + " is in another shard");
+            printf("%lu,%lu: %d\n", i, j, scores.score(i, j));
+        }
+    }
+
+    if (result.count("row"))
+    {
+        const auto i = result["row"].as<size_t>();
+        check_index(scores, i);
+        // a shard only prints the pairs it stores
+        for (size_t j = 0; j < scores.size(); j++)
+            if (j != i && scores.contains(triangular_index(std::min(i, j), std::max(i, j), scores.size())))
+                printf("%lu,%lu: %d\n", i, j, scores.score(i, j));
+    }
+
+    if (result.count("text"))
+    {
+        std::ofstream file(result["text"].as<std::string>());
+        printf("Writing %s\n", result["text"].as<std::string>().c_str());
+        for (size_t k = info.first_score; k < info.first_score + info.number_of_scores; k++)
+            file << scores.at(k) << '\n';
+    }
+
+    return 0;
+}
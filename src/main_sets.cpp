@@ -2,73 +2,141 @@
  * Copyright 2022 - UPMEM
  */
 
-#include <fstream>
-
 #include "../libnwdpu/host/dpu_common.hpp"
 #include "timeline.hpp"
-#include <vector>
-#include <variant>
-#include <functional>
 
+#include "dataset_cache.hpp"
 #include "parameters.hpp"
-template <class... Ts>
-struct overloaded : Ts...
+
+/**
+ * @brief Aligns the sets of the source, results are written to scores.txt and cigars.txt while they are computed.
+ * In star mode, the representative of each set (its index in the set) is written to representatives.txt.
+ *
+ */
+void write_alignments(const SetWindowSource &source, const NwParameters &nw_parameters, uint32_t ranks, std::optional<Representative> star = std::nullopt)
 {
-    using Ts::operator()...;
-};
-template <class... Ts>
-overloaded(Ts...) -> overloaded<Ts...>;
-using AlignmentResult = std::variant<std::vector<NwType>, std::vector<int>>;
+    ResultWriter writer("scores.txt", "cigars.txt");
+
+    if (!star)
+    {
+        dpu_cigar_pipeline("./libnwdpu/dpu/nw_affine", nw_parameters, ranks, source, writer);
+        printf("Wrote %lu alignments to scores.txt and cigars.txt\n", writer.size());
+        return;
+    }
+
+    std::ofstream representatives("representatives.txt");
+    dpu_cigar_pipeline("./libnwdpu/dpu/nw_affine", nw_parameters, ranks, source, writer, star,
+                       [&representatives](SetAlignments &&window)
+                       {
+                           for (const auto r : window.representatives)
+                               representatives << r << '\n';
+                       });
+
+    printf("Wrote %lu alignments to scores.txt and cigars.txt, representatives to representatives.txt\n", writer.size());
+}
+
+/**
+ * @brief Aligns the pairs of a pair list, results are written to scores.txt and cigars.txt in the order of the list
+ *
+ */
+void pair_alignments(const std::string &dataset_path, const std::string &pairs_path, const NwParameters &nw_parameters, uint32_t ranks)
+{
+    if (pairs_path.empty())
+        exit("Pair mode needs a pair list (pairs in the yaml file or -p)");
+
+    printf("Dataset:\n");
+    Timer load_time{};
+    auto dataset = load_seq_dataset(dataset_path);
+    auto pairs = load_pair_list(pairs_path, dataset.size());
+    printf("  sequences: %lu\n"
+           "  pairs:     %lu\n",
+           dataset.size(), pairs.size());
+    load_time.Print("  ");
+
+    ResultWriter writer("scores.txt", "cigars.txt");
+    dpu_pair_pipeline("./libnwdpu/dpu/nw_affine", nw_parameters, ranks, dataset, pairs, writer);
+
+    printf("Wrote %lu alignments to scores.txt and cigars.txt\n", writer.size());
+}
 
-void write_to_file(AlignmentResult &alignments)
+/**
+ * @brief Aligns a dataset window by window
+ *
+ */
+void stream_alignments(const std::string &dataset_path, uint32_t nsets, const NwParameters &nw_parameters, uint32_t ranks, uint32_t window_size,
+                       std::optional<Representative> star)
 {
-    std::visit(overloaded{[](const std::vector<NwType> &vec)
-                          {
-                              dump_to_file("scores.txt", vec, [](const auto &e)
-                                           { return e.score; });
-                              dump_to_file("cigars.txt", vec, [](const auto &e)
-                                           { return e.cigar; });
-                          },
-                          [](const std::vector<int> &vec)
-                          {
-                              dump_to_file("scores.txt", vec, [](const auto &e)
-                                           { return e; });
-                          }},
-               alignments);
+    printf("Dataset:\n"
+           "  streamed by windows of %u MB\n\n",
+           window_size);
+
+    write_alignments(stream_set_dataset(dataset_path, size_t{window_size} << 20, nsets), nw_parameters, ranks, star);
 }
 
 int main(int argc, char **argv)
 {
-    auto [dataset_path, nsets, nw_parameters, ranks, app_mode] = populate_parameters(argc, argv);
+    auto [dataset_path, nsets, nw_parameters, ranks, app_mode, window_size, pairs_path, representative] = populate_parameters(argc, argv);
 
     Timeline timeline{"log_times.csv"};
 
     printf("DPU ranks: %u\n\n", ranks);
     nw_parameters.Print();
 
+    // star mode: members are only aligned with the representative of their set
+    std::optional<Representative> star{};
+    if (app_mode == AppMode::Star)
+    {
+        star = representative;
+        printf("Star mode, representative: %s\n\n", to_string(representative).c_str());
+    }
+
+    if ((app_mode == AppMode::Set || app_mode == AppMode::Star) && window_size > 0)
+    {
+        timeline.mark("Initialization");
+        Timer compute_time{};
+        stream_alignments(dataset_path, nsets, nw_parameters, ranks, window_size, star);
+        compute_time.Print("  ");
+        timeline.mark("Alignement");
+        return 0;
+    }
+
+    if (app_mode == AppMode::Pair)
+    {
+        timeline.mark("Initialization");
+        Timer compute_time{};
+        pair_alignments(dataset_path, pairs_path, nw_parameters, ranks);
+        compute_time.Print("  ");
+        timeline.mark("Alignement");
+        return 0;
+    }
+
     printf("Dataset:\n");
     Timer load_time{};
-    auto dataset = read_set_fasta(dataset_path) |
-                   print_size<Sets>("  max: ") |
-                   resize<Sets>(nsets) |
-                   print_size<Sets>("  use: ") |
-                   encode<Sets>;
+    auto dataset = load_set_dataset(dataset_path);
+    printf("  max: %lu\n", dataset.number_of_sets());
+    dataset.truncate_sets(nsets);
+    printf("  use: %lu\n", dataset.number_of_sets());
     load_time.Print("  ");
 
     timeline.mark("Initialization");
 
-    AlignmentResult alignments;
-
     Timer compute_time{};
     switch (app_mode)
     {
     case AppMode::Set:
+    case AppMode::Star:
     {
-        alignments = dpu_cigar_pipeline("./libnwdpu/dpu/nw_affine", nw_parameters, ranks, dataset);
+        bool sent = false;
+        write_alignments([&]() -> std::optional<SequenceStore>
+                         {
+                             if (sent)
+                                 return std::nullopt;
+                             sent = true;
+                             return dataset;
+                         },
+                         nw_parameters, ranks, star);
         break;
     }
-    case AppMode::Pair:
-        break;
     case AppMode::All:
     {
         printf("All against all mode not implemented yet, use dpu_16S\n");
@@ -83,18 +151,5 @@ int main(int argc, char **argv)
 
     timeline.mark("Alignement");
 
-    if (std::holds_alternative<std::vector<NwType>>(alignments))
-    {
-        printf("Returned vector of NwType\n");
-        printf("Scores and CIGARs were computed\n");
-    }
-    else if (std::holds_alternative<std::vector<int>>(alignments))
-    {
-        printf("Returned vector of int\n");
-        printf("Only scores were computed\n");
-    }
-
-    write_to_file(alignments);
-
     return 0;
 }
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#ifndef A02D04D2D_6B48_4EC9_AF43_927915DA0F59
+#define A02D04D2D_6B48_4EC9_AF43_927915DA0F59
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>    // for open
+#include <sys/mman.h> // for mmap
+#include <unistd.h>   // for close
+
+/**
+ * @brief Private view of a whole file mapped in memory, the file on disk is never written.
+ * The mapping is writable (PROT_WRITE, MAP_PRIVATE): pages are only copied when written,
+ * which allows in place rewriting (ex: joining multi-line sequences) without
+ * touching the file on disk.
+ * An anonymous mapping can also be created, to hold a decompressed file,
+ * or a new file mapped shared, to write an output file in place.
+ *
+ */
+class MappedFile
+{
+    char *data = nullptr;
+    size_t size = 0;
+
+    MappedFile(char *d, size_t s) : data(d), size(s) {}
+
+public:
+    MappedFile() = delete;
+
+    /**
+     * @brief Creates an anonymous mapping, pages are only allocated when written
+     *
+     * @param size
+     * @return MappedFile
+     */
+    static MappedFile anonymous(size_t size)
+    {
+        if (size == 0)
+            return MappedFile(nullptr, 0);
+
+        auto *d = static_cast<char *>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+        if (d == MAP_FAILED)
+        {
+            perror("Error mapping memory");
+            exit(EXIT_FAILURE);
+        }
+
+        return MappedFile(d, size);
+    }
+
+    explicit MappedFile(const std::string &filename)
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd == -1)
+        {
+            perror("Error opening file");
+            exit(EXIT_FAILURE);
+        }
+
+        off_t s = lseek(fd, 0, SEEK_END);
+        if (s == -1)
+        {
+            perror("Error getting file size");
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+
+        size = s;
+
+        if (size == 0)
+        {
+            close(fd);
+            return;
+        }
+
+        data = static_cast<char *>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0));
+        if (data == MAP_FAILED)
+        {
+            perror("Error mapping file");
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+
+        close(fd);
+    }
+
+    /**
+     * @brief Creates a file of the given size, or truncates an existing one, and maps it shared:
+     * writes go to the file through the page cache and never use anonymous memory.
+     *
+     * @param filename
+     * @param size
+     * @return MappedFile
+     */
+    static MappedFile create(const std::string &filename, size_t size)
+    {
+        int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1)
+        {
+            perror("Error creating file");
+            exit(EXIT_FAILURE);
+        }
+
+        if (ftruncate(fd, static_cast<off_t>(size)) == -1)
+        {
+            perror("Error resizing file");
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+
+        if (size == 0)
+        {
+            close(fd);
+            return MappedFile(nullptr, 0);
+        }
+
+        auto *d = static_cast<char *>(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+        if (d == MAP_FAILED)
+        {
+            perror("Error mapping file");
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+
+        close(fd);
+        return MappedFile(d, size);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) noexcept
+        : data(std::exchange(other.data, nullptr)), size(std::exchange(other.size, 0)) {}
+
+    MappedFile &operator=(MappedFile &&other) noexcept
+    {
+        std::swap(data, other.data);
+        std::swap(size, other.size);
+        return *this;
+    }
+
+    ~MappedFile()
+    {
+        if (data != nullptr && munmap(data, size) == -1)
+        {
+            perror("Error unmapping file");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /**
+     * @brief Release the pages fully inside [begin, end), they must not be accessed anymore.
+     * Used to bound memory when a file is consumed sequentially.
+     *
+     * @param begin
+     * @param end
+     */
+    void release(const char *begin, const char *end)
+    {
+        const auto page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        const auto first = (reinterpret_cast<uintptr_t>(begin) + page - 1) & ~(page - 1);
+        const auto last = reinterpret_cast<uintptr_t>(end) & ~(page - 1);
+
+        if (first < last)
+            madvise(reinterpret_cast<void *>(first), last - first, MADV_DONTNEED);
+    }
+
+    /**
+     * @brief Grows or shrinks an anonymous mapping, data may move.
+     * Not to be used on a file mapping.
+     *
+     * @param new_size
+     */
+    void resize(size_t new_size)
+    {
+        if (data == nullptr || new_size == 0)
+        {
+            *this = anonymous(new_size);
+            return;
+        }
+
+        auto *d = static_cast<char *>(mremap(data, size, new_size, MREMAP_MAYMOVE));
+        if (d == MAP_FAILED)
+        {
+            perror("Error remapping memory");
+            exit(EXIT_FAILURE);
+        }
+
+        data = d;
+        size = new_size;
+    }
+
+    /// @brief Writes the pages of a shared file mapping back to the file and waits for it
+    void sync()
+    {
+        if (data != nullptr && msync(data, size, MS_SYNC) == -1)
+        {
+            perror("Error syncing file");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    inline const char *getData() const { return data; }
+    inline char *getData() { return data; }
+    inline size_t getSize() const { return size; }
+};
+
+#endif /* A02D04D2D_6B48_4EC9_AF43_927915DA0F59 */
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+
+#include "pack.hpp"
+#include "types.hpp"
+
+// A nucleotide code is (c >> 1) & 3, base 4i+m of a sequence goes to bits 2m of byte i.
+//
+// Scalar: codes of 4 bytes of a little endian word, at bits 0, 8, 16 and 24, are gathered in the
+// top byte of the word by a single multiplication, shifting them by 24, 18, 12 and 6. Other
+// partial products land on disjoint bit pairs, no carry reaches the top byte. The same holds for
+// 8 bytes of a 64 bits word, the second byte being gathered in bits 56 to 63.
+//
+// SIMD: maddubs with weights (1, 4) then madd with weights (1, 16) compute the packed byte
+// of each group of 4 codes in a 32 bits lane, lanes are then narrowed to bytes.
+
+/// Packs the largest multiple of the kernel width of seq, returns the number of nucleotides packed
+using PackKernel = size_t (*)(const char *seq, size_t size, uint8_t *out);
+
+static constexpr uint64_t code_mask = 0x0303030303030303LU;
+static constexpr uint64_t gather_multiplier = 0x01041040LU;
+
+static size_t pack_scalar(const char *seq, size_t size, uint8_t *out)
+{
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, seq + i, sizeof(word));
+        const uint64_t packed = ((word >> 1) & code_mask) * gather_multiplier;
+        out[i / 4] = static_cast<uint8_t>(packed >> 24);
+        out[i / 4 + 1] = static_cast<uint8_t>(packed >> 56);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t pack_avx2(const char *seq, size_t size, uint8_t *out)
+{
+    const auto mask = _mm256_set1_epi8(3);
+    const auto weights_2 = _mm256_set1_epi16(0x0401);
+    const auto weights_4 = _mm256_set1_epi32(0x00100001);
+    const auto low_bytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const auto lanes = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(seq + i));
+        v = _mm256_and_si256(_mm256_srli_epi16(v, 1), mask);
+        v = _mm256_madd_epi16(_mm256_maddubs_epi16(v, weights_2), weights_4);
+        v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, low_bytes), lanes);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i / 4), _mm256_castsi256_si128(v));
+    }
+    return i;
+}
+
+__attribute__((target("avx512bw"))) static size_t pack_avx512(const char *seq, size_t size, uint8_t *out)
+{
+    const auto mask = _mm512_set1_epi8(3);
+    const auto weights_2 = _mm512_set1_epi16(0x0401);
+    const auto weights_4 = _mm512_set1_epi32(0x00100001);
+
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64)
+    {
+        auto v = _mm512_loadu_si512(seq + i);
+        v = _mm512_and_si512(_mm512_srli_epi16(v, 1), mask);
+        v = _mm512_madd_epi16(_mm512_maddubs_epi16(v, weights_2), weights_4);
+        _mm512_mask_cvtepi32_storeu_epi8(out + i / 4, 0xFFFF, v);
+    }
+
+    // the tail is loaded with a mask, bytes past the end of seq are never read
+    const auto tail = (size - i) & ~size_t{3};
+    if (tail > 0)
+    {
+        auto v = _mm512_maskz_loadu_epi8((uint64_t{1} << tail) - 1, seq + i);
+        v = _mm512_and_si512(_mm512_srli_epi16(v, 1), mask);
+        v = _mm512_madd_epi16(_mm512_maddubs_epi16(v, weights_2), weights_4);
+        _mm512_mask_cvtepi32_storeu_epi8(out + i / 4, static_cast<__mmask16>((1U << (tail / 4)) - 1), v);
+        i += tail;
+    }
+    return i;
+}
+
+static PackKernel select_kernel(const char *&name)
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512bw"))
+    {
+        name = "avx512bw";
+        return pack_avx512;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        name = "avx2";
+        return pack_avx2;
+    }
+    name = "scalar";
+    return pack_scalar;
+}
+
+static const char *kernel_name = nullptr;
+static const PackKernel pack_kernel = select_kernel(kernel_name);
+
+void pack_sequence(std::string_view seq, uint8_t *out)
+{
+    auto done = pack_kernel(seq.data(), seq.size(), out);
+    done += pack_scalar(seq.data() + done, seq.size() - done, out + done / 4);
+
+    std::fill(out + done / 4, out + compressed_size(seq.size()), uint8_t{0});
+
+    for (size_t i = done; i < seq.size(); i++)
+        out[i / 4] |= static_cast<uint8_t>(((seq[i] >> 1) & 3) << ((i % 4) * 2));
+}
+
+const char *pack_kernel_name()
+{
+    return kernel_name;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#ifndef E7DE12F9_F3AD_4D45_87C7_758AD80E46FD
+#define E7DE12F9_F3AD_4D45_87C7_758AD80E46FD
+
+#include <cstdint>
+#include <string_view>
+
+/**
+ * @brief Encode from ACTG/actg to 0123 (ksw2 encoding, undefined for other values)
+ * and pack 4 nucleotides per byte in the dpu layout, in a single pass. Padding is zeroed.
+ * The kernel (AVX-512BW, AVX2 or scalar) is selected once, on the running host.
+ * No byte is read past the end of seq.
+ *
+ * @param seq nucleotides
+ * @param out buffer of at least compressed_size(seq.size()) bytes
+ */
+void pack_sequence(std::string_view seq, uint8_t *out);
+
+/**
+ * @brief Name of the pack kernel selected for the running host
+ *
+ * @return "avx512bw", "avx2" or "scalar"
+ */
+const char *pack_kernel_name();
+
+#endif /* E7DE12F9_F3AD_4D45_87C7_758AD80E46FD */
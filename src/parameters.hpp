@@ -2,15 +2,18 @@
 #define B31A7004_1AB6_4DC0_A536_DAB73DAC2F8E
 
 #include <filesystem>
+#include <sstream>
 #include <yaml-cpp/yaml.h>
 
 #include "cxxopts.hpp"
 #include "fasta.hpp"
+#include "representative.hpp"
 
 enum class AppMode
 {
     Set,
     Pair,
+    Star,
     All
 };
 
@@ -24,6 +27,9 @@ inline std::ostream &operator<<(std::ostream &os, const AppMode &mode)
     case AppMode::Pair:
         os << "pair";
         break;
+    case AppMode::Star:
+        os << "star";
+        break;
     case AppMode::All:
         os << "all";
         break;
@@ -39,6 +45,8 @@ inline std::istream &operator>>(std::istream &is, AppMode &mode)
         mode = AppMode::Set;
     else if (token == "pair")
         mode = AppMode::Pair;
+    else if (token == "star")
+        mode = AppMode::Star;
     else if (token == "all")
         mode = AppMode::All;
     else
@@ -54,6 +62,8 @@ inline std::string to_string(const AppMode &mode)
         return "set";
     case AppMode::Pair:
         return "pair";
+    case AppMode::Star:
+        return "star";
     case AppMode::All:
         return "all";
     }
@@ -68,17 +78,28 @@ auto read_parameters(const std::filesystem::path &filename)
     auto ranks = config["ranks"].as<uint32_t>();
     auto params = config["nw_params"];
     auto app_mode_str = config["app_mode"].as<std::string>();
+    auto window_size = config["window_size"] ? config["window_size"].as<uint32_t>() : 0U;
+    auto pairs = config["pairs"] ? config["pairs"].as<std::string>() : std::string{};
+    auto representative = Representative::Longest;
     AppMode app_mode;
 
     if (app_mode_str == "set")
         app_mode = AppMode::Set;
     else if (app_mode_str == "pair")
         app_mode = AppMode::Pair;
+    else if (app_mode_str == "star")
+        app_mode = AppMode::Star;
     else if (app_mode_str == "all")
         app_mode = AppMode::All;
     else
         throw std::runtime_error("Invalid app mode in config file");
 
+    if (config["representative"])
+    {
+        std::istringstream token(config["representative"].as<std::string>());
+        token >> representative;
+    }
+
     return std::tuple{
         path,
         sets_number,
@@ -88,7 +109,10 @@ auto read_parameters(const std::filesystem::path &filename)
                      params["gap_extension"].as<int32_t>(),
                      128},
         ranks,
-        app_mode};
+        app_mode,
+        window_size,
+        pairs,
+        representative};
 }
 
 cxxopts::ParseResult parse_command_line(int argc, char **argv)
@@ -103,7 +127,10 @@ cxxopts::ParseResult parse_command_line(int argc, char **argv)
         "x,mismatch", "Mismatch score", cxxopts::value<int32_t>())(
         "g,gap_opening", "Gap opening score", cxxopts::value<int32_t>())(
         "e,gap_extension", "Gap extension score", cxxopts::value<int32_t>())(
-        "a,app_mode", "Application mode (set, pair, all)", cxxopts::value<AppMode>());
+        "a,app_mode", "Application mode (set, pair, star, all)", cxxopts::value<AppMode>())(
+        "w,window_size", "Stream the dataset by windows of this many MB, 0 loads it at once (optional)", cxxopts::value<uint32_t>())(
+        "p,pairs", "Path to the pair list, for the pair mode", cxxopts::value<std::string>())(
+        "representative", "Representative of each set in the star mode (longest, medoid, first)", cxxopts::value<Representative>());
 
     options.add_options()("h,help", "Print usage");
 
@@ -143,10 +170,13 @@ auto populate_parameters(int argc, char **argv)
     uint32_t ranks{};
     NwParameters nw_parameters{0, 0, 0, 0, 128};
     AppMode app_mode{AppMode::Set};
+    uint32_t window_size{};
+    std::string pairs{};
+    Representative representative{Representative::Longest};
 
     if (result.count("config") > 0)
     {
-        std::tie(path, sets_number, nw_parameters, ranks, app_mode) = read_parameters(result["config"].as<std::string>());
+        std::tie(path, sets_number, nw_parameters, ranks, app_mode, window_size, pairs, representative) = read_parameters(result["config"].as<std::string>());
     }
 
     update_parameter(result, "dataset", path);
@@ -157,13 +187,19 @@ auto populate_parameters(int argc, char **argv)
     update_parameter(result, "gap_opening", nw_parameters.gap_opening);
     update_parameter(result, "gap_extension", nw_parameters.gap_extension);
     update_parameter(result, "app_mode", app_mode);
+    update_parameter(result, "window_size", window_size);
+    update_parameter(result, "pairs", pairs);
+    update_parameter(result, "representative", representative);
 
     return std::tuple{
         path,
         sets_number,
         nw_parameters,
         ranks,
-        app_mode};
+        app_mode,
+        window_size,
+        pairs,
+        representative};
 }
 
 #endif /* B31A7004_1AB6_4DC0_A536_DAB73DAC2F8E */
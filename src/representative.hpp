@@ -0,0 +1,159 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#ifndef A7574844_062A_4C64_9CD6_0D8C631A9245
+#define A7574844_062A_4C64_9CD6_0D8C631A9245
+
+#include <array>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "sequence_store.hpp"
+
+/**
+ * @brief Choice of the representative of each set in the star mode, every other member is aligned with it
+ *
+ */
+enum class Representative
+{
+    Longest, /// longest sequence of the set, the first one on ties
+    Medoid,  /// sequence closest to the others by k-mer profile
+    First    /// first sequence of the set in the dataset, given by the input
+};
+
+inline std::string to_string(const Representative &r)
+{
+    switch (r)
+    {
+    case Representative::Longest:
+        return "longest";
+    case Representative::Medoid:
+        return "medoid";
+    case Representative::First:
+        return "first";
+    }
+    throw std::runtime_error("Invalid representative");
+}
+
+inline std::ostream &operator<<(std::ostream &os, const Representative &r)
+{
+    return os << to_string(r);
+}
+
+inline std::istream &operator>>(std::istream &is, Representative &r)
+{
+    std::string token;
+    is >> token;
+    if (token == "longest")
+        r = Representative::Longest;
+    else if (token == "medoid")
+        r = Representative::Medoid;
+    else if (token == "first")
+        r = Representative::First;
+    else
+        throw std::runtime_error("Invalid representative");
+    return is;
+}
+
+/// @brief Length of the k-mers of the medoid profiles
+constexpr size_t PROFILE_KMER = 4;
+
+/**
+ * @brief Counts of the k-mers of a sequence, read from its packed representation
+ *
+ */
+inline auto kmer_profile(const SequenceStore &store, size_t i)
+{
+    std::array<uint32_t, size_t{1} << (2 * PROFILE_KMER)> profile{};
+    const auto packed = store.packed(i);
+    constexpr uint32_t mask = (1U << (2 * PROFILE_KMER)) - 1;
+
+    uint32_t kmer = 0;
+    for (uint32_t n = 0; n < store.length(i); n++)
+    {
+        kmer = ((kmer << 2) | ((packed[n / 4] >> ((n % 4) * 2)) & 3U)) & mask;
+        if (n + 1 >= PROFILE_KMER)
+            profile[kmer]++;
+    }
+
+    return profile;
+}
+
+/**
+ * @brief Medoid of a set: the member with the least sum of squared distances of k-mer profiles to the others.
+ * That sum is k |x_i|^2 - 2 x_i.S + sum |x_j|^2 with S the sum of the profiles, so it is found in linear time.
+ *
+ * @return index of the medoid in the set
+ */
+inline uint32_t set_medoid(const SequenceStore &store, size_t s)
+{
+    const auto begin = store.set_begin(s);
+    const auto k = store.set_size(s);
+
+    std::vector<std::array<uint32_t, size_t{1} << (2 * PROFILE_KMER)>> profiles(k);
+    std::array<double, size_t{1} << (2 * PROFILE_KMER)> sum{};
+    for (size_t m = 0; m < k; m++)
+    {
+        profiles[m] = kmer_profile(store, begin + m);
+        for (size_t e = 0; e < sum.size(); e++)
+            sum[e] += profiles[m][e];
+    }
+
+    uint32_t best = 0;
+    double best_distance = 0;
+    for (size_t m = 0; m < k; m++)
+    {
+        double norm = 0;
+        double dot = 0;
+        for (size_t e = 0; e < sum.size(); e++)
+        {
+            const auto x = static_cast<double>(profiles[m][e]);
+            norm += x * x;
+            dot += x * sum[e];
+        }
+
+        const auto distance = static_cast<double>(k) * norm - 2 * dot;
+        if (m == 0 || distance < best_distance)
+        {
+            best = static_cast<uint32_t>(m);
+            best_distance = distance;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * @brief Representative of each set of the store
+ *
+ * @return index of the representative in its set, for each set
+ */
+inline std::vector<uint32_t> choose_representatives(const SequenceStore &store, Representative choice)
+{
+    std::vector<uint32_t> representatives(store.number_of_sets());
+    if (choice == Representative::First)
+        return representatives;
+
+#pragma omp parallel for schedule(dynamic, 1024)
+    for (size_t s = 0; s < store.number_of_sets(); s++)
+    {
+        if (choice == Representative::Medoid)
+        {
+            representatives[s] = set_medoid(store, s);
+            continue;
+        }
+
+        const auto begin = store.set_begin(s);
+        for (size_t m = 1; m < store.set_size(s); m++)
+            if (store.length(begin + m) > store.length(begin + representatives[s]))
+                representatives[s] = static_cast<uint32_t>(m);
+    }
+
+    return representatives;
+}
+
+#endif /* A7574844_062A_4C64_9CD6_0D8C631A9245 */
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include <charconv>
+
+#include <fcntl.h>  // for open
+#include <unistd.h> // for pwrite
+
+#include "result_writer.hpp"
+
+static int create_output(const std::filesystem::path &path)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        perror("Error creating output file");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+static void write_at(int fd, const std::string &buffer, uint64_t offset)
+{
+    size_t written = 0;
+    while (written < buffer.size())
+    {
+        auto n = pwrite(fd, buffer.data() + written, buffer.size() - written, static_cast<off_t>(offset + written));
+        if (n == -1)
+        {
+            perror("Error writing output file");
+            exit(EXIT_FAILURE);
+        }
+        written += static_cast<size_t>(n);
+    }
+}
+
+ResultWriter::ResultWriter(const std::filesystem::path &scores_path, const std::filesystem::path &cigars_path, size_t threads)
+    : scores_fd(create_output(scores_path)), cigars_fd(create_output(cigars_path)), pool(threads)
+{
+    printf("Writing %s and %s\n", scores_path.c_str(), cigars_path.c_str());
+}
+
+ResultWriter::~ResultWriter()
+{
+    pool.wait();
+    close(scores_fd);
+    close(cigars_fd);
+}
+
+size_t ResultWriter::reserve(size_t n)
+{
+    std::lock_guard lock(mutex);
+    reserved += n;
+    return reserved - n;
+}
+
+ResultWriter::Buffers ResultWriter::serialize(std::span<const NwType> results, const CigarArena &cigars)
+{
+    Buffers buffers;
+    char number[16];
+
+    for (const auto &e : results)
+    {
+        auto end = std::to_chars(number, number + sizeof(number), e.score).ptr;
+        buffers.scores.append(number, end);
+        buffers.scores.push_back('\n');
+
+        cigars[e.cigar].expand(buffers.cigars);
+        buffers.cigars.push_back('\n');
+    }
+
+    return buffers;
+}
+
+void ResultWriter::commit(size_t id, Buffers &&buffers)
+{
+    std::vector<std::pair<Buffers, std::pair<uint64_t, uint64_t>>> ready;
+
+    {
+        std::lock_guard lock(mutex);
+        serialized.emplace(id, std::move(buffers));
+
+        // give file offsets to the chunks following the last one written
+        for (auto it = serialized.begin(); it != serialized.end() && it->first == next_chunk; it = serialized.erase(it))
+        {
+            ready.emplace_back(std::move(it->second), std::make_pair(scores_offset, cigars_offset));
+            scores_offset += ready.back().first.scores.size();
+            cigars_offset += ready.back().first.cigars.size();
+            next_chunk++;
+        }
+    }
+
+    // consecutive chunks are written in one go
+    if (ready.size() > 1)
+    {
+        for (size_t i = 1; i < ready.size(); i++)
+        {
+            ready.front().first.scores += ready[i].first.scores;
+            ready.front().first.cigars += ready[i].first.cigars;
+        }
+        ready.resize(1);
+    }
+
+    for (const auto &[b, offsets] : ready)
+    {
+        write_at(scores_fd, b.scores, offsets.first);
+        write_at(cigars_fd, b.cigars, offsets.second);
+    }
+}
+
+void ResultWriter::write(std::vector<Chunk> &&chunks, const CigarArena &cigars, std::function<void()> done)
+{
+    pool.submit([this, chunks = std::move(chunks), &cigars, done = std::move(done)]
+                {
+                    std::vector<Buffers> buffers;
+                    buffers.reserve(chunks.size());
+                    for (const auto &[id, results] : chunks)
+                    {
+                        buffers.push_back(serialize(results, cigars));
+                        n_results += results.size();
+                    }
+
+                    // results are not read anymore
+                    if (done)
+                        done();
+
+                    for (size_t i = 0; i < chunks.size(); i++)
+                        commit(chunks[i].first, std::move(buffers[i]));
+                });
+}
+
+void ResultWriter::finish()
+{
+    pool.wait();
+
+    std::lock_guard lock(mutex);
+    if (next_chunk != reserved)
+        exit("Missing results: " + std::to_string(reserved - next_chunk) + " chunks not written");
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#ifndef FF4FA973_ED0D_4702_B7DD_7038597AC59E
+#define FF4FA973_ED0D_4702_B7DD_7038597AC59E
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cigar_arena.hpp"
+#include "thread_pool.hpp"
+
+/**
+ * @brief Writes alignment results to scores.txt / cigars.txt like files while they are computed.
+ * Results are split in chunks numbered in output order (a set of the dataset for the set pipeline).
+ * Chunks are handed over in any order, as soon as a batch is post-processed, and serialized by
+ * worker threads into their own buffers. Once all the chunks before one are serialized, its file
+ * offsets are known and it is written in place, so the files are identical to a sequential dump.
+ *
+ */
+class ResultWriter
+{
+public:
+    /// @brief A chunk given to the writer: its number and its results
+    using Chunk = std::pair<size_t, std::span<const NwType>>;
+
+private:
+    /// @brief Serialized chunk
+    struct Buffers
+    {
+        std::string scores{}; /// one score per line
+        std::string cigars{}; /// one expanded CIGAR per line
+    };
+
+    int scores_fd = -1;
+    int cigars_fd = -1;
+
+    std::mutex mutex{};
+    std::map<size_t, Buffers> serialized{}; /// chunks serialized, waiting for the previous ones
+    size_t next_chunk = 0;                  /// first chunk not yet given a file offset
+    size_t reserved = 0;                    /// number of chunks reserved
+    uint64_t scores_offset = 0;             /// end of the scores given a file offset
+    uint64_t cigars_offset = 0;             /// end of the cigars given a file offset
+    std::atomic<size_t> n_results{0};
+
+    // declared last, the workers are joined before the rest is destroyed
+    ThreadPool pool;
+
+    static Buffers serialize(std::span<const NwType> results, const CigarArena &cigars);
+    void commit(size_t id, Buffers &&buffers);
+
+public:
+    /**
+     * @brief Creates (or truncates) the output files
+     *
+     * @param scores_path
+     * @param cigars_path
+     * @param threads number of serialization threads
+     */
+    ResultWriter(const std::filesystem::path &scores_path, const std::filesystem::path &cigars_path,
+                 size_t threads = std::thread::hardware_concurrency());
+
+    ResultWriter(const ResultWriter &) = delete;
+    ResultWriter &operator=(const ResultWriter &) = delete;
+
+    /// @brief Waits for the pending chunks and closes the files
+    ~ResultWriter();
+
+    /**
+     * @brief Reserves n consecutive chunk numbers, the chunks are written after all the ones reserved before
+     *
+     * @param n
+     * @return size_t first chunk number
+     */
+    size_t reserve(size_t n);
+
+    /**
+     * @brief Serializes and writes chunks asynchronously. The results and their CIGARs must stay valid until
+     * done is called, done is called from a worker thread once the results are serialized.
+     *
+     * @param chunks
+     * @param cigars storage of the CIGARs of the results
+     * @param done
+     */
+    void write(std::vector<Chunk> &&chunks, const CigarArena &cigars, std::function<void()> done = {});
+
+    /**
+     * @brief Waits until all the chunks reserved are written
+     *
+     */
+    void finish();
+
+    /// @brief Number of results written
+    size_t size() const { return n_results; }
+};
+
+#endif /* FF4FA973_ED0D_4702_B7DD_7038597AC59E */
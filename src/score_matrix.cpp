@@ -0,0 +1,165 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include <vector>
+
+#include "score_matrix.hpp"
+
+static constexpr char matrix_magic[8] = "NWDPUSM";
+static constexpr uint32_t matrix_version = 2;
+static constexpr uint64_t matrix_data_offset = 128;
+
+static size_t score_bytes(ScoreType type)
+{
+    return type == ScoreType::Int16 ? sizeof(int16_t) : sizeof(int32_t);
+}
+
+ScoreMatrix::ScoreMatrix(MappedFile &&f, const ScoreMatrixHeader &h)
+    : file(std::move(f)), header(h), scores(file.getData() + h.data_offset) {}
+
+ScoreShard score_shard(std::span<const uint32_t> lengths, size_t shard, size_t shards)
+{
+    const auto n = lengths.size();
+
+    // load of each row, the pairs with the following sequences
+    std::vector<uint64_t> loads(n);
+    uint64_t following = 0;
+    for (size_t i = n; i-- > 0;)
+    {
+        const uint64_t pairs = n - 1 - i;
+        loads[i] = pairs * lengths[i] + following - pairs;
+        following += lengths[i];
+    }
+
+    uint64_t total = 0;
+    for (const auto l : loads)
+        total += l;
+
+    // first row whose cumulated load reaches floor(total * s / shards)
+    auto first_row = [&](size_t s)
+    {
+        if (s == 0)
+            return size_t{0};
+        if (s >= shards)
+            return n;
+        const auto target = total / shards * s + total % shards * s / shards;
+        uint64_t cumulated = 0;
+        size_t i = 0;
+        while (i < n && cumulated + loads[i] <= target)
+            cumulated += loads[i++];
+        return i;
+    };
+
+    return {first_row(shard), first_row(shard + 1)};
+}
+
+ScoreMatrix ScoreMatrix::create(const std::filesystem::path &filename, size_t n, ScoreType type, const NwParameters &params,
+                                uint64_t fingerprint, std::optional<ScoreShard> shard)
+{
+    static_assert(sizeof(ScoreMatrixHeader) <= matrix_data_offset);
+
+    ScoreMatrixHeader header{};
+    std::memcpy(header.magic, matrix_magic, sizeof(matrix_magic));
+    header.version = matrix_version;
+    header.type = type;
+    header.size = n;
+    header.first_score = shard ? row_begin(shard->first_row, n) : 0;
+    header.number_of_scores = shard ? row_begin(shard->last_row, n) - header.first_score : sum_integers(n);
+    header.data_offset = matrix_data_offset;
+    header.match = params.match;
+    header.mismatch = params.mismatch;
+    header.gap_opening = params.gap_opening;
+    header.gap_extension = params.gap_extension;
+    header.fingerprint = fingerprint;
+
+    auto file = MappedFile::create(filename, matrix_data_offset + header.number_of_scores * score_bytes(type));
+    std::memcpy(file.getData(), &header, sizeof(header));
+
+    return ScoreMatrix(std::move(file), header);
+}
+
+ScoreMatrix ScoreMatrix::open(const std::filesystem::path &filename)
+{
+    MappedFile file(filename);
+
+    ScoreMatrixHeader header{};
+    if (file.getSize() < sizeof(header))
+        exit("Invalid score matrix: " + filename.native());
+    std::memcpy(&header, file.getData(), sizeof(header));
+
+    if (std::memcmp(header.magic, matrix_magic, sizeof(matrix_magic)) != 0 || header.version != matrix_version)
+        exit("Invalid score matrix version: " + filename.native());
+
+    if (header.type != ScoreType::Int32 && header.type != ScoreType::Int16)
+        exit("Invalid score matrix type: " + filename.native());
+
+    if (header.first_score > sum_integers(header.size) || header.number_of_scores > sum_integers(header.size) - header.first_score ||
+        header.data_offset < sizeof(header) || header.data_offset > file.getSize() ||
+        header.number_of_scores > (file.getSize() - header.data_offset) / score_bytes(header.type))
+        exit("Truncated score matrix: " + filename.native());
+
+    return ScoreMatrix(std::move(file), header);
+}
+
+void ScoreMatrix::finish()
+{
+    file.sync();
+
+    header.complete = 1;
+    std::memcpy(file.getData(), &header, sizeof(header));
+    file.sync();
+}
+
+void ScoreMatrix::merge(const ScoreMatrix &shard)
+{
+    const auto &from = shard.info();
+    if (from.size != header.size || from.type != header.type)
+        exit("Shard of another matrix: " + std::to_string(from.size) + " sequences, matrix of " + std::to_string(header.size));
+    // an empty shard (more shards than rows) may start at the end of the matrix
+    if (from.number_of_scores == 0)
+        return;
+    if (!contains(from.first_score) || from.number_of_scores > header.number_of_scores - (from.first_score - header.first_score))
+        exit("Shard out of the matrix: scores from " + std::to_string(from.first_score));
+
+    const auto bytes = score_bytes(header.type);
+    std::memcpy(scores + (from.first_score - header.first_score) * bytes, shard.scores, from.number_of_scores * bytes);
+}
+
+ScoreMatrix merge_shards(const std::filesystem::path &filename, std::vector<ScoreMatrix> &shards)
+{
+    if (shards.empty())
+        exit("No shard to merge");
+
+    // shards are contiguous ranges of the triangular matrix, they must cover it exactly once
+    std::ranges::sort(shards, {}, [](const auto &s)
+                      { return s.info().first_score; });
+
+    const auto &first = shards.front().info();
+    size_t next = 0;
+    for (const auto &s : shards)
+    {
+        const auto &info = s.info();
+        if (info.complete == 0)
+            exit("Shard of scores " + std::to_string(info.first_score) + " is incomplete, its run did not finish");
+        if (info.fingerprint != first.fingerprint)
+            exit("Shards of different datasets: their sequences differ");
+        if (info.size != first.size || info.type != first.type || info.match != first.match || info.mismatch != first.mismatch ||
+            info.gap_opening != first.gap_opening || info.gap_extension != first.gap_extension)
+            exit("Shards of different matrices: sizes, score types and alignment parameters must match");
+        if (info.first_score != next)
+            exit(info.first_score > next ? "Scores " + std::to_string(next) + " to " + std::to_string(info.first_score) + " are in no shard"
+                                         : "Shards overlap at score " + std::to_string(info.first_score));
+        next += info.number_of_scores;
+    }
+    if (next != sum_integers(first.size))
+        exit("Scores " + std::to_string(next) + " to " + std::to_string(sum_integers(first.size)) + " are in no shard");
+
+    const NwParameters params{first.match, first.mismatch, first.gap_opening, first.gap_extension, 128};
+    auto merged = ScoreMatrix::create(filename, first.size, first.type, params, first.fingerprint);
+    for (const auto &s : shards)
+        merged.merge(s);
+    merged.finish();
+
+    return merged;
+}
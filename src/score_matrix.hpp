@@ -0,0 +1,203 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#ifndef C1259FA2_04F5_408C_A318_A6332E383170
+#define C1259FA2_04F5_408C_A318_A6332E383170
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "types.hpp"
+
+/**
+ * @brief Type of the scores stored in a score matrix
+ *
+ */
+enum class ScoreType : uint32_t
+{
+    Int32 = 0, /// exact scores
+    Int16 = 1  /// scores saturated to int16, half the size
+};
+
+/**
+ * @brief Header of a score matrix file.
+ * Scores of all the pairs (i, j), i < j, of n sequences follow the header,
+ * at triangular_index(i, j, n), as computed by the 16S pipeline.
+ * A shard only holds the scores [first_score, first_score + number_of_scores) of the matrix,
+ * the pairs of a range of rows.
+ *
+ */
+struct ScoreMatrixHeader
+{
+    /// @brief File layout
+    char magic[8];             /// "NWDPUSM" followed by a null byte
+    uint32_t version;          /// format version
+    ScoreType type;            /// type of the stored scores
+    uint64_t size;             /// number of sequences
+    uint64_t number_of_scores; /// number of pairs stored, sum_integers(size) for a whole matrix
+    uint64_t data_offset;      /// file offset of the scores
+    int32_t match;             /// match score used
+    int32_t mismatch;          /// mismatch score used
+    int32_t gap_opening;       /// gap opening score used
+    int32_t gap_extension;     /// gap extension score used
+    uint64_t first_score;      /// triangular index of the first score stored, 0 for a whole matrix
+    uint32_t complete;         /// 1 once all the scores are written, a run stopped before leaves 0
+    uint32_t pad;              /// padding
+    uint64_t fingerprint;      /// dataset_fingerprint of the sequences, the same for all the shards of a matrix
+};
+
+/**
+ * @brief Rows [first_row, last_row) of a score matrix, the part of a shard
+ *
+ */
+struct ScoreShard
+{
+    size_t first_row{}; /// first row
+    size_t last_row{};  /// end of the rows
+};
+
+/// @brief Triangular index of the first pair of row i of n sequences, sum_integers(n) for i == n
+inline size_t row_begin(size_t i, size_t n)
+{
+    return sum_integers(n) - sum_integers(n - i);
+}
+
+/**
+ * @brief Rows of a shard of the score matrix, shards are contiguous ranges of rows of about the same load:
+ * the pairs (i, j) cost l_i + l_j - 1 as in count_compute_load
+ *
+ * @param lengths lengths of the sequences
+ * @param shard index of the shard
+ * @param shards number of shards
+ * @return ScoreShard
+ */
+ScoreShard score_shard(std::span<const uint32_t> lengths, size_t shard, size_t shards);
+
+/**
+ * @brief Upper triangular matrix of alignment scores stored in a memory mapped file.
+ * A matrix created for writing is mapped shared, scores are written in place in the
+ * file as they are gathered, so the whole matrix never sits in anonymous memory.
+ *
+ */
+class ScoreMatrix
+{
+    MappedFile file;
+    ScoreMatrixHeader header{};
+    char *scores = nullptr;
+
+    ScoreMatrix(MappedFile &&f, const ScoreMatrixHeader &h);
+
+public:
+    /**
+     * @brief Creates a score matrix file for n sequences, or for the rows of a shard of it
+     *
+     * @param filename
+     * @param n number of sequences
+     * @param type type of the stored scores
+     * @param params alignment parameters, recorded in the header
+     * @param fingerprint dataset_fingerprint of the sequences, recorded in the header
+     * @param shard rows stored, all of them if not set
+     * @return ScoreMatrix
+     */
+    static ScoreMatrix create(const std::filesystem::path &filename, size_t n, ScoreType type, const NwParameters &params,
+                              uint64_t fingerprint, std::optional<ScoreShard> shard = std::nullopt);
+
+    /**
+     * @brief Maps an existing score matrix file
+     *
+     * @param filename
+     * @return ScoreMatrix
+     */
+    static ScoreMatrix open(const std::filesystem::path &filename);
+
+    /// @brief Header of the matrix
+    const ScoreMatrixHeader &info() const { return header; }
+
+    /// @brief Number of sequences
+    size_t size() const { return header.size; }
+
+    /// @brief Returns true if the scores of the pair at a triangular index are stored
+    bool contains(size_t index) const { return index >= header.first_score && index - header.first_score < header.number_of_scores; }
+
+    /// @brief Marks the matrix complete once all its scores are written, they are synced to the file first
+    void finish();
+
+    /**
+     * @brief Copies the scores of a shard of the same matrix, stored with the same type
+     *
+     * @param shard
+     */
+    void merge(const ScoreMatrix &shard);
+
+    /**
+     * @brief Writes consecutive scores, starting at a triangular index stored by the matrix
+     *
+     * @param index triangular_index of the first pair
+     * @param values
+     */
+    void store(size_t index, std::span<const int32_t> values)
+    {
+        index -= header.first_score;
+        if (header.type == ScoreType::Int32)
+        {
+            std::memcpy(scores + index * sizeof(int32_t), values.data(), values.size_bytes());
+            return;
+        }
+
+        auto *out = reinterpret_cast<int16_t *>(scores) + index;
+        for (size_t k = 0; k < values.size(); k++)
+            out[k] = static_cast<int16_t>(std::clamp<int32_t>(values[k],
+                                                              std::numeric_limits<int16_t>::min(),
+                                                              std::numeric_limits<int16_t>::max()));
+    }
+
+    /**
+     * @brief Returns the score at a triangular index stored by the matrix
+     *
+     * @param index
+     * @return int32_t
+     */
+    int32_t at(size_t index) const
+    {
+        index -= header.first_score;
+        if (header.type == ScoreType::Int32)
+        {
+            int32_t v;
+            std::memcpy(&v, scores + index * sizeof(int32_t), sizeof(v));
+            return v;
+        }
+        return reinterpret_cast<const int16_t *>(scores)[index];
+    }
+
+    /**
+     * @brief Returns the score of sequences i and j, in any order, i and j must differ
+     *
+     * @param i
+     * @param j
+     * @return int32_t
+     */
+    int32_t score(size_t i, size_t j) const
+    {
+        if (i > j)
+            std::swap(i, j);
+        return at(triangular_index(i, j, header.size));
+    }
+};
+
+/**
+ * @brief Merges the shards of a score matrix in a new file. Exits unless the shards are complete, of the same
+ * dataset (fingerprint), size, score type and alignment parameters, and cover the matrix exactly once.
+ *
+ * @param filename merged matrix
+ * @param shards sorted by first score
+ * @return ScoreMatrix
+ */
+ScoreMatrix merge_shards(const std::filesystem::path &filename, std::vector<ScoreMatrix> &shards);
+
+#endif /* C1259FA2_04F5_408C_A318_A6332E383170 */
@@ -0,0 +1,282 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#ifndef F5B7CDAD_EE75_41A1_9986_9D52F8C026F9
+#define F5B7CDAD_EE75_41A1_9986_9D52F8C026F9
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <span>
+#include <vector>
+
+#include "types.hpp"
+
+/**
+ * @brief Owned storage of a SequenceStore, filled when sequences are parsed from a fasta file
+ *
+ */
+struct SequenceBuffers
+{
+    /// @brief Flat arrays
+    std::vector<uint8_t> data{};          /// packed sequences
+    std::vector<uint64_t> offsets{};      /// byte offset of each sequence in data
+    std::vector<uint32_t> lengths{};      /// length in nucleotides of each sequence
+    std::vector<uint64_t> set_offsets{0}; /// index of the first sequence of each set, plus total number of sequences
+};
+
+/**
+ * @brief Flat collection of sequences grouped in sets.
+ * Sequences are stored packed on 2 bits in the dpu layout, each one padded to
+ * compressed_size(length), so they can be copied as is to a dpu buffer.
+ * Sequences of a set are contiguous.
+ * The store only holds views, the memory is owned either by SequenceBuffers
+ * or by a mapped dataset cache file, kept alive by the store.
+ *
+ */
+class SequenceStore
+{
+    std::shared_ptr<const void> storage{};
+
+public:
+    /// @brief Flat arrays
+    std::span<const uint8_t> data{};         /// packed sequences, indexed by offsets
+    std::span<const uint64_t> offsets{};     /// byte offset of each sequence in data
+    std::span<const uint32_t> lengths{};     /// length in nucleotides of each sequence
+    std::span<const uint64_t> set_offsets{}; /// index of the first sequence of each set, plus total number of sequences
+
+    SequenceStore() = default;
+
+    /// @brief Create a store viewing memory owned by storage
+    SequenceStore(std::shared_ptr<const void> owner,
+                  std::span<const uint8_t> d,
+                  std::span<const uint64_t> o,
+                  std::span<const uint32_t> l,
+                  std::span<const uint64_t> so)
+        : storage(std::move(owner)), data(d), offsets(o), lengths(l), set_offsets(so) {}
+
+    /// @brief Create a store owning its buffers
+    explicit SequenceStore(SequenceBuffers &&buffers)
+    {
+        auto owned = std::make_shared<const SequenceBuffers>(std::move(buffers));
+        data = owned->data;
+        offsets = owned->offsets;
+        lengths = owned->lengths;
+        set_offsets = owned->set_offsets;
+        storage = std::move(owned);
+    }
+
+    /// @brief Number of sequences
+    size_t size() const { return lengths.size(); }
+
+    /// @brief Number of sets
+    size_t number_of_sets() const { return set_offsets.empty() ? 0 : set_offsets.size() - 1; }
+
+    /// @brief Index of the first sequence of set s
+    size_t set_begin(size_t s) const { return set_offsets[s]; }
+
+    /// @brief Number of sequences in set s
+    size_t set_size(size_t s) const { return set_offsets[s + 1] - set_offsets[s]; }
+
+    /// @brief Length in nucleotides of sequence i
+    uint32_t length(size_t i) const { return lengths[i]; }
+
+    /// @brief Packed representation of sequence i, padding included
+    std::span<const uint8_t> packed(size_t i) const
+    {
+        return data.subspan(offsets[i], compressed_size(lengths[i]));
+    }
+
+    /// @brief Packed representation of the sequences [first, last) of a same set, they are contiguous
+    std::span<const uint8_t> packed_range(size_t first, size_t last) const
+    {
+        if (first == last)
+            return {};
+        const auto begin = offsets[first];
+        const auto end = offsets[last - 1] + compressed_size(lengths[last - 1]);
+        return data.subspan(begin, end - begin);
+    }
+
+    /// @brief Packed representation of all the sequences of set s, they are contiguous
+    std::span<const uint8_t> packed_set(size_t s) const
+    {
+        return packed_range(set_offsets[s], set_offsets[s + 1]);
+    }
+
+    /**
+     * @brief Returns a store viewing sets [first, last) of this one, sequences are not copied.
+     *
+     * @param first
+     * @param last
+     * @return SequenceStore
+     */
+    SequenceStore slice_sets(size_t first, size_t last) const
+    {
+        const auto seq_begin = set_offsets[first];
+        const auto seq_end = set_offsets[last];
+
+        // set offsets are rebased on the first sequence, offsets still index the whole data
+        auto owner = std::make_shared<std::pair<std::shared_ptr<const void>, std::vector<uint64_t>>>(
+            storage, std::vector<uint64_t>(set_offsets.begin() + first, set_offsets.begin() + last + 1));
+        for (auto &e : owner->second)
+            e -= seq_begin;
+
+        std::span<const uint64_t> rebased = owner->second;
+
+        return SequenceStore(std::move(owner),
+                             data,
+                             offsets.subspan(seq_begin, seq_end - seq_begin),
+                             lengths.subspan(seq_begin, seq_end - seq_begin),
+                             rebased);
+    }
+
+    /**
+     * @brief Keep only the n first sets, nothing is done if n is greater than the number of sets.
+     *
+     * @param n
+     */
+    void truncate_sets(size_t n)
+    {
+        if (n >= number_of_sets())
+            return;
+
+        set_offsets = set_offsets.first(n + 1);
+        const auto n_seq = set_offsets.back();
+
+        offsets = offsets.first(n_seq);
+        lengths = lengths.first(n_seq);
+        data = data.first(n_seq == 0 ? 0 : offsets.back() + compressed_size(lengths.back()));
+    }
+};
+
+/// @brief Produces the next window of sets of a dataset, std::nullopt once the dataset is exhausted
+using SetWindowSource = std::function<std::optional<SequenceStore>()>;
+
+/**
+ * @brief Pair of an explicit pair list, indexes of sequences of a store
+ *
+ */
+struct SequencePair
+{
+    uint32_t first{};  /// first sequence
+    uint32_t second{}; /// second sequence
+};
+
+/**
+ * @brief Fingerprint of the sequences of a store: a hash (FNV-1a) of their lengths and nucleotides,
+ * independent of the padding of the packed sequences. Tells apart the score matrices of different datasets.
+ *
+ * @param store
+ * @return uint64_t
+ */
+inline uint64_t dataset_fingerprint(const SequenceStore &store)
+{
+    uint64_t hash = 0xcbf29ce484222325LU;
+    auto add = [&hash](uint8_t byte)
+    { hash = (hash ^ byte) * 0x100000001b3LU; };
+
+    for (size_t i = 0; i < store.size(); i++)
+    {
+        const auto length = store.length(i);
+        for (size_t b = 0; b < sizeof(length); b++)
+            add(static_cast<uint8_t>(length >> (8 * b)));
+
+        // 4 nucleotides per byte, the bits after the last one are not part of the sequence
+        const auto packed = store.packed(i);
+        for (size_t b = 0; b < length / 4; b++)
+            add(packed[b]);
+        if (length % 4 != 0)
+            add(static_cast<uint8_t>(packed[length / 4] & ((1U << (2 * (length % 4))) - 1)));
+    }
+
+    return hash;
+}
+
+/**
+ * @brief Returns the number of unique pairs of a set
+ *
+ * @param store
+ * @param s set index
+ * @return size_t
+ */
+inline size_t count_unique_pair(const SequenceStore &store, size_t s)
+{
+    return sum_integers(store.set_size(s));
+}
+
+/**
+ * @brief Returns the total number of unique pairs in all the sets of the store
+ *
+ * @param store
+ * @return size_t
+ */
+inline size_t count_unique_pair(const SequenceStore &store)
+{
+    size_t res = 0;
+    for (size_t s = 0; s < store.number_of_sets(); s++)
+        res += count_unique_pair(store, s);
+    return res;
+}
+
+/**
+ * @brief Estimate the number of cells to compute for a block of pairs of set s (assuming banded N&W):
+ * the pairs of the sequences [rows, rows + row_count) with [cols, cols + col_count), or the distinct pairs
+ * of the block if rows == cols and row_count == col_count. Sum over the pairs of (l_i + l_j - 1).
+ *
+ * @param store
+ * @param s set index
+ * @param rows first sequence of the rows in the set
+ * @param row_count
+ * @param cols first sequence of the columns in the set
+ * @param col_count
+ * @return Load estimation
+ */
+inline size_t count_compute_load(const SequenceStore &store, size_t s, size_t rows, size_t row_count, size_t cols, size_t col_count)
+{
+    const auto begin = store.set_begin(s);
+    auto total_length = [&](size_t first, size_t count)
+    {
+        size_t total = 0;
+        for (size_t i = begin + first; i < begin + first + count; i++)
+            total += store.length(i);
+        return total;
+    };
+
+    // each length of a block with itself appears in k - 1 pairs
+    if (rows == cols && row_count == col_count)
+        return row_count < 2 ? 0 : (row_count - 1) * total_length(rows, row_count) - sum_integers(row_count);
+    return col_count * total_length(rows, row_count) + row_count * total_length(cols, col_count) - row_count * col_count;
+}
+
+/**
+ * @brief Estimate the number of cells to compute for a set (assuming banded N&W).
+ * Sum over all pairs of (l_i + l_j - 1), each length appearing in k - 1 pairs.
+ *
+ * @param store
+ * @param s set index
+ * @return Load estimation
+ */
+inline size_t count_compute_load(const SequenceStore &store, size_t s)
+{
+    const auto k = store.set_size(s);
+    return count_compute_load(store, s, 0, k, 0, k);
+}
+
+/**
+ * @brief Returns the size a dpu buffer needs to contains the packed sequences of a set
+ *
+ * @param store
+ * @param s set index
+ * @return uint32_t
+ */
+inline uint32_t compressed_size(const SequenceStore &store, size_t s)
+{
+    uint32_t total = 0;
+    for (size_t i = store.set_begin(s); i < store.set_begin(s) + store.set_size(s); i++)
+        total += compressed_size(store.length(i));
+    return total;
+}
+
+#endif /* F5B7CDAD_EE75_41A1_9986_9D52F8C026F9 */
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#ifndef DDF610A0_DAE3_4A9C_BB30_846A9DF63A8C
+#define DDF610A0_DAE3_4A9C_BB30_846A9DF63A8C
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed set of worker threads running tasks in submission order.
+ * Used for host work that must not hold a DPU callback thread, tasks are
+ * expected to be independent and to not throw.
+ *
+ */
+class ThreadPool
+{
+    std::vector<std::thread> workers{};
+    std::deque<std::function<void()>> tasks{};
+    std::mutex mutex{};
+    std::condition_variable task_ready{};
+    std::condition_variable idle{};
+    size_t running = 0;
+    bool stop = false;
+
+    void work()
+    {
+        std::unique_lock lock(mutex);
+        while (true)
+        {
+            task_ready.wait(lock, [this]
+                            { return stop || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+
+            auto task = std::move(tasks.front());
+            tasks.pop_front();
+            running++;
+
+            lock.unlock();
+            task();
+            lock.lock();
+
+            running--;
+            if (tasks.empty() && running == 0)
+                idle.notify_all();
+        }
+    }
+
+public:
+    /**
+     * @brief Starts n worker threads, at least one
+     *
+     * @param n
+     */
+    explicit ThreadPool(size_t n)
+    {
+        n = std::max(n, size_t{1});
+        workers.reserve(n);
+        for (size_t i = 0; i < n; i++)
+            workers.emplace_back([this]
+                                 { work(); });
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /// @brief Runs the remaining tasks and joins the workers
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard lock(mutex);
+            stop = true;
+        }
+        task_ready.notify_all();
+        for (auto &w : workers)
+            w.join();
+    }
+
+    /// @brief Number of worker threads
+    size_t size() const { return workers.size(); }
+
+    /**
+     * @brief Queues a task
+     *
+     * @param task
+     */
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        task_ready.notify_one();
+    }
+
+    /**
+     * @brief Runs f(i) for all i in [0, n) on the workers and on the calling thread, returns once all are done.
+     * Iterations are claimed one by one, so the caller completes the loop alone if the workers are busy.
+     * Must not be called from a task of this pool.
+     *
+     * @param n
+     * @param f
+     */
+    template <typename F>
+    void parallel_for(size_t n, F &&f)
+    {
+        struct Loop
+        {
+            std::atomic<size_t> next{0};
+            size_t done = 0;
+            std::mutex mutex{};
+            std::condition_variable finished{};
+        };
+
+        auto loop = std::make_shared<Loop>();
+
+        // f is only called while the caller waits, helpers starting late find no iteration left
+        auto body = [loop, n, &f]
+        {
+            size_t count = 0;
+            for (size_t i = loop->next++; i < n; i = loop->next++, count++)
+                f(i);
+
+            if (count == 0)
+                return;
+
+            std::lock_guard lock(loop->mutex);
+            loop->done += count;
+            if (loop->done == n)
+                loop->finished.notify_all();
+        };
+
+        for (size_t h = 1; h < std::min(n, size() + 1); h++)
+            submit(body);
+        body();
+
+        std::unique_lock lock(loop->mutex);
+        loop->finished.wait(lock, [&]
+                            { return loop->done == n; });
+    }
+
+    /// @brief Waits until all the tasks submitted are done
+    void wait()
+    {
+        std::unique_lock lock(mutex);
+        idle.wait(lock, [this]
+                  { return tasks.empty() && running == 0; });
+    }
+};
+
+#endif /* DDF610A0_DAE3_4A9C_BB30_846A9DF63A8C */
@@ -8,6 +8,9 @@
 #include <stdint.h>
 #include <time.h>
 
+#include <atomic>
+#include <string>
+
 /**
  * @brief Wrapper around timespec for easy convertion
  *
@@ -85,4 +88,37 @@ public:
     }
 };
 
+/**
+ * @brief Wall time spent in a stage of a pipeline, summed over all its runs, from any thread
+ *
+ */
+class StageTime
+{
+    std::atomic<uint64_t> nanoseconds{0};
+    std::atomic<uint64_t> runs{0};
+
+public:
+    /// @brief Adds a run of the stage started at start
+    /// @param start
+    void add(const Time &start)
+    {
+        nanoseconds += static_cast<uint64_t>((Time{CLOCK_MONOTONIC_RAW} - start) * 1e9);
+        runs++;
+    }
+
+    /// @brief Total time in seconds
+    double total() const { return static_cast<double>(nanoseconds) * 1e-9; }
+
+    /// @brief Number of runs
+    uint64_t count() const { return runs; }
+
+    /// @brief Prints total and mean time of the stage
+    /// @param name
+    void Print(const std::string &name) const
+    {
+        printf("  %-12s %8.3f s, %6lu runs, mean %.3f ms\n", name.c_str(), total(), count(),
+               count() == 0 ? 0.0 : total() * 1e3 / static_cast<double>(count()));
+    }
+};
+
 #endif /* F9C8281F_F477_471C_B5BE_4ACE15AE8324 */
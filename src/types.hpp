@@ -9,10 +9,9 @@
 #include <concepts>
 #include <filesystem>
 #include <fstream>
+#include <span>
 #include <vector>
 
-#include <immintrin.h>
-
 #include "../cdefs.h"
 #include "timer.hpp"
 
@@ -46,11 +45,56 @@ struct NwParameters
 };
 
 /**
- * @brief CIGAR Representation
+ * @brief View on a CIGAR, kept run-length encoded as produced by the dpu
+ * (see CIGAR_RUN in cdefs.h): one byte per run of a same operation, in alignment order.
+ * The one character per column form ('=', 'X', 'I', 'D') is only built on demand.
  *
  */
-struct Cigar : public std::string
+struct CigarView
 {
+    /// @brief Runs, in alignment order
+    std::span<const uint8_t> runs{};
+
+    /// @brief Character of each operation, indexed by TraceValue
+    static constexpr char operations[4] = {'X', '=', 'I', 'D'};
+
+    /**
+     * @brief Number of columns of the alignment
+     *
+     * @return size_t
+     */
+    size_t size() const
+    {
+        size_t n = 0;
+        for (const auto run : runs)
+            n += CIGAR_RUN_LENGTH(run);
+        return n;
+    }
+
+    /**
+     * @brief Expands the CIGAR, one character per column
+     *
+     * @return std::string
+     */
+    std::string expand() const
+    {
+        std::string cigar;
+        cigar.reserve(size());
+        expand(cigar);
+        return cigar;
+    }
+
+    /**
+     * @brief Appends the expanded CIGAR to a string
+     *
+     * @param out
+     */
+    void expand(std::string &out) const
+    {
+        for (const auto run : runs)
+            out.append(CIGAR_RUN_LENGTH(run), operations[CIGAR_RUN_OP(run)]);
+    }
+
     /**
      * @brief Computes score of CIGAR
      *
@@ -62,25 +106,41 @@ struct Cigar : public std::string
         int score = 0;
         int gap = 0;
 
-        for (const auto &e : *this)
+        for (const auto run : runs)
         {
-            if (e == '=')
-                score += params.match, gap = 0;
-            else if (e == 'X')
-                score += params.mismatch, gap = 0;
+            const int length = CIGAR_RUN_LENGTH(run);
+            const auto op = CIGAR_RUN_OP(run);
+
+            if (op == DMATCH)
+                score += length * params.match, gap = 0;
+            else if (op == DMISS)
+                score += length * params.mismatch, gap = 0;
             else
             {
                 if (gap == 0)
                     score -= params.gap_opening, gap++;
-                score -= params.gap_extension;
+                score -= length * params.gap_extension;
             }
         }
         return score;
     }
+
+    /// @brief Writes the expanded CIGAR
+    friend std::ostream &operator<<(std::ostream &os, const CigarView &cigar)
+    {
+        return os << cigar.expand();
+    }
 };
 
-/// @brief Type for a collection of CIGARs
-using Cigars = std::vector<Cigar>;
+/**
+ * @brief CIGAR of an alignment, its runs are stored in a CigarArena
+ *
+ */
+struct Cigar
+{
+    uint64_t offset{}; /// offset of the runs in the arena
+    uint32_t length{}; /// number of runs
+};
 
 /**
  * @brief Type for Needleman & Wunsch return values
@@ -91,18 +151,11 @@ struct NwType
     /// @brief Aggregate data
     int score{};   /// Score from alignment
     Cigar cigar{}; /// CIGAR of the alignment
-    size_t dpu_offset{};
-    size_t mi{};
 };
 
-/********** Set / Sequence **********/
+/********** Sequence **********/
 
-using Sequence = std::string;                          /// Sequence type
-using Set = std::vector<Sequence>;                     /// Set type
-using Sets = std::vector<Set>;                         /// Sets type
-using CompressedSequence = std::vector<uint8_t>;       /// Compressed sequence type
-using CompressedSequences = std::vector<uint8_t>;      /// Compressed sequences type
-using CompressedSet = std::vector<CompressedSequence>; /// Compressed set type
+using CompressedSequences = std::vector<uint8_t>; /// Compressed sequences type
 
 /**
  * @brief Sum of the first i numbers, starting at 0.
@@ -124,78 +177,6 @@ static constexpr auto round_up8(std::integral auto n)
     return (n + 7) & ~7;
 }
 
-/**
- * @brief Returns the total number of unique pairs in a collection of set
- *
- * @param sets
- * @return size_t
- */
-inline size_t count_unique_pair(const Sets &sets)
-{
-    size_t res = 0;
-    for (const auto &set : sets)
-        res += sum_integers(set.size());
-    return res;
-}
-
-/**
- * @brief Estimate the number of cells to compute for given Set (assuming banded N&W)
- *
- * @param set
- * @return Load estimation
- */
-inline size_t count_compute_load(const Set &set)
-{
-    size_t compute_load = 0;
-    for (size_t i = 0; i < set.size() - 1; i++)
-        for (size_t j = i + 1; j < set.size(); j++)
-            compute_load += set[i].size() + set[j].size() - 1;
-
-    return compute_load;
-}
-
-/**
- * @brief Estimate the total compute load of a collection of Set.
- *
- * @param sets
- * @return size_t
- */
-inline size_t count_compute_load(const Sets &sets)
-{
-    size_t compute_load = 0;
-    for (const auto &set : sets)
-        compute_load += count_compute_load(set);
-
-    return compute_load;
-}
-
-/********** nucleotide to ksw2 encoding **********/
-
-/**
- * @brief Encode from ACTG/actg to 0123, undefined for other values
- *
- * @param c nucleotide
- */
-template <typename C>
-constexpr C &encode(C &&c)
-{
-    if constexpr (std::is_same_v<char, std::remove_reference_t<C>>)
-    {
-        c >>= 1;
-        constexpr uint8_t mask = 0b11;
-        c &= mask;
-
-        return c;
-    }
-    else
-    {
-        for (auto &e : c)
-            encode(e);
-
-        return c;
-    }
-}
-
 /**
  * @brief A small helper operator to chain operations
  *
@@ -288,121 +269,28 @@ static inline size_t triangular_index(size_t i, size_t j, size_t n)
 }
 
 /**
- * @brief Return the size a dpu buffer needs to contains the compressed representation of a sequence
- *
- * @param size
- * @return constexpr uint32_t
- */
-constexpr uint32_t compressed_size(size_t size)
-{
-    auto compressed_size = static_cast<uint32_t>((size + 3) / 4);
-    return round_up8(compressed_size);
-}
-
-/**
- * @brief Return the size a dpu buffer needs to contains the compressed representation of a set
+ * @brief Gives the index of the alignment of a member of a set with its representative (star mode):
+ * members in set order, the representative skipped
  *
- * @param size
- * @return constexpr uint32_t
+ * @param representative index of the representative in the set
+ * @param member index of the member in the set, not the representative
+ * @return size_t
  */
-constexpr uint32_t compressed_size(Set set)
+static inline size_t star_index(size_t representative, size_t member)
 {
-    uint32_t total = 0;
-    for (const auto &e : set)
-        total += compressed_size(e.size());
-    return total;
+    return member < representative ? member : member - 1;
 }
 
 /**
- * @brief Return the size a dpu buffer needs to contains the compressed representation of a sets
+ * @brief Return the size a dpu buffer needs to contains the compressed representation of a sequence
  *
  * @param size
  * @return constexpr uint32_t
  */
-constexpr uint32_t compressed_size(Sets sets)
-{
-    uint32_t total = 0;
-    for (const auto &e : sets)
-        total += compressed_size(e);
-    return total;
-}
-
-/**
- * @brief Return the compressed representation a sequence
- *
- * @param seq
- * @return CompressedSequence
- */
-inline CompressedSequence compress_sequence(const Sequence &seq)
-{
-    uint32_t csize = compressed_size(seq.size());
-    CompressedSequence cseq(csize);
-
-    for (size_t i = 0; i < csize; i += 2)
-    {
-        size_t seq_id = i * 4;
-
-        auto c4n = _pext_u64(*(uint64_t *)(seq.data() + seq_id), 0x0303030303030303);
-        *(uint16_t *)(cseq.data() + i) = c4n;
-    }
-
-    return cseq;
-}
-
-/**
- * @brief Returns a Set of the compressed sequences
- *
- * @param set
- * @return CompressedSet
- */
-inline CompressedSet compress_set(const Set &set)
-{
-    CompressedSet cset(set.size());
-
-#pragma omp parallel for
-    for (size_t i = 0; i < set.size(); i++)
-        cset[i] = compress_sequence(set[i]);
-
-    return cset;
-}
-
-/**
- * @brief Concat a compressed sequence to an existing buffer
- *
- * @param cseqs
- * @param cseq
- */
-inline void push_back(CompressedSequences &cseqs, const CompressedSequence &cseq)
-{
-    size_t begin = cseqs.size();
-    cseqs.resize(begin + cseq.size());
-
-    for (size_t i = 0; i < cseq.size(); i++)
-        cseqs[begin + i] = cseq[i];
-}
-
-/**
- * @brief Concat a compressed sequence to an existing buffer
- *
- * @param cseqs
- * @param cseq
- */
-inline uint32_t compressed_emplace(CompressedSequences &cseqs, const Sequence &seq)
+constexpr uint32_t compressed_size(size_t size)
 {
-    const uint32_t csize = compressed_size(seq.size());
-
-    const size_t begin = cseqs.size();
-    cseqs.resize(begin + csize);
-
-    for (size_t i = 0; i < csize; i += 2)
-    {
-        size_t seq_id = i * 4;
-
-        auto c4n = _pext_u64(*(uint64_t *)(seq.data() + seq_id), 0x0303030303030303);
-        *(uint16_t *)(cseqs.data() + begin + i) = c4n;
-    }
-
-    return csize;
+    auto compressed_size = static_cast<uint32_t>((size + 3) / 4);
+    return round_up8(compressed_size);
 }
 
 #endif /* AD18B383_F97E_4512_98DA_46CE2947ACDD */
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#ifndef E3F1B7A2_5C4D_4B9E_8A61_2D7F0C9E4B13
+#define E3F1B7A2_5C4D_4B9E_8A61_2D7F0C9E4B13
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>    // for open
+#include <sys/wait.h> // for waitpid
+#include <unistd.h>   // for fork
+
+/// @brief Number of failed checks of the test
+inline size_t failures = 0;
+
+/// @brief Records a failed condition without stopping the test, so that every failure is printed
+#define CHECK(condition)                                                                \
+    do                                                                                  \
+    {                                                                                   \
+        if (!(condition))                                                               \
+        {                                                                               \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);\
+            failures++;                                                                 \
+        }                                                                               \
+    } while (0)
+
+/**
+ * @brief Returns true if f exits the process with a failure, as exit(std::string) does on invalid input.
+ * f is run in a child process whose output is discarded.
+ *
+ */
+template <class F>
+bool exits(F &&f)
+{
+    fflush(stdout);
+    const auto pid = fork();
+    if (pid == 0)
+    {
+        dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+        f();
+        std::_Exit(EXIT_SUCCESS);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_FAILURE;
+}
+
+/// @brief Prints the outcome of the test, to be returned by main
+inline int report(const char *name)
+{
+    printf("%s: %s\n", name, failures == 0 ? "passed" : "FAILED");
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif /* E3F1B7A2_5C4D_4B9E_8A61_2D7F0C9E4B13 */
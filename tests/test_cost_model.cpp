@@ -0,0 +1,116 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include <cmath>
+#include <vector>
+
+#include "check.hpp"
+#include "../libnwdpu/host/CostModel.hpp"
+
+/// @brief Samples of a batch of dpus whose cycles follow exactly the given coefficients
+static std::vector<CostSample> batch(const CostModel::Coefficients &truth, size_t n_dpus, size_t seed)
+{
+    std::vector<CostSample> samples;
+    for (size_t i = 0; i < n_dpus; i++)
+    {
+        const double pairs = 1 + (i * 7 + seed * 13) % 40;
+        const double diagonals = pairs * (300 + (i * 31 + seed * 17) % 1500);
+        samples.push_back({diagonals, pairs, truth(diagonals, pairs)});
+    }
+    return samples;
+}
+
+static bool near(double a, double b, double tolerance = 1e-6) { return std::abs(a - b) <= tolerance * std::abs(b); }
+
+static void starts_from_the_prior()
+{
+    const CostModel model;
+    CHECK(model.coefficients().per_diagonal == CostModel::cigar_prior.per_diagonal);
+    CHECK(model.coefficients().per_pair == CostModel::cigar_prior.per_pair);
+}
+
+static void recovers_known_coefficients()
+{
+    const CostModel::Coefficients truth{1100.0, 25000.0};
+    CostModel model;
+    const auto samples = batch(truth, 64, 0);
+    model.observe(samples);
+
+    CHECK(near(model.coefficients().per_diagonal, truth.per_diagonal));
+    CHECK(near(model.coefficients().per_pair, truth.per_pair));
+}
+
+static void ignores_dpus_without_pairs()
+{
+    const CostModel::Coefficients truth{1100.0, 25000.0};
+    CostModel model;
+    auto samples = batch(truth, 64, 1);
+    // a dpu without work still reports the cycles of its setup
+    samples.push_back({0, 0, 1e9});
+    model.observe(samples);
+
+    CHECK(near(model.coefficients().per_diagonal, truth.per_diagonal));
+    CHECK(near(model.coefficients().per_pair, truth.per_pair));
+}
+
+static void forgets_older_batches()
+{
+    const CostModel::Coefficients before{1100.0, 25000.0};
+    const CostModel::Coefficients after{1500.0, 40000.0};
+    CostModel model;
+    for (size_t i = 0; i < 10; i++)
+    {
+        const auto samples = batch(before, 64, i);
+        model.observe(samples);
+    }
+
+    // one batch of the new kernel moves the fit only part of the way, the past weighs 0.9
+    const auto first = batch(after, 64, 10);
+    model.observe(first);
+    CHECK(model.coefficients().per_diagonal > before.per_diagonal);
+    CHECK(model.coefficients().per_diagonal < after.per_diagonal);
+
+    // after enough batches the old samples weigh 0.9^200, the fit is the new kernel
+    for (size_t i = 11; i < 200; i++)
+    {
+        const auto samples = batch(after, 64, i);
+        model.observe(samples);
+    }
+    CHECK(near(model.coefficients().per_diagonal, after.per_diagonal, 1e-3));
+    CHECK(near(model.coefficients().per_pair, after.per_pair, 1e-3));
+}
+
+static void keeps_the_prior_ratio_on_collinear_samples()
+{
+    // every dpu aligns pairs of the same shape: diagonals and pairs cannot be told apart
+    const CostModel::Coefficients prior{1000.0, 16000.0};
+    CostModel model(prior);
+    std::vector<CostSample> samples;
+    for (size_t i = 1; i <= 64; i++)
+        samples.push_back({i * 1000.0, double(i), i * 2.0 * (1000.0 * 1000.0 + 16000.0)});
+    model.observe(samples);
+
+    // cycles are twice the prior: the scale is fitted, the ratio is the prior one
+    CHECK(near(model.coefficients().per_diagonal, 2 * prior.per_diagonal));
+    CHECK(near(model.coefficients().per_pair, 2 * prior.per_pair));
+}
+
+static void empty_batches_keep_the_estimate()
+{
+    CostModel model;
+    model.observe({});
+    CHECK(model.coefficients().per_diagonal == CostModel::cigar_prior.per_diagonal);
+    CHECK(model.coefficients().per_pair == CostModel::cigar_prior.per_pair);
+}
+
+int main()
+{
+    starts_from_the_prior();
+    recovers_known_coefficients();
+    ignores_dpus_without_pairs();
+    forgets_older_batches();
+    keeps_the_prior_ratio_on_collinear_samples();
+    empty_batches_keep_the_estimate();
+    return report("cost model");
+}
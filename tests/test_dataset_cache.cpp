@@ -0,0 +1,106 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "../src/dataset_cache.hpp"
+
+static const auto directory = std::filesystem::temp_directory_path() / ("test_dataset_cache." + std::to_string(getpid()));
+
+/// @brief Cache of three sets of sequences, as written by write_dataset_cache
+static std::vector<char> cache_bytes()
+{
+    const auto fasta = directory / "dataset.fa";
+    std::ofstream(fasta) << ">0\nACGTACGTACGTACGTACGTACGTACGTACGTACGTA\n>0\nGGATC\n>1\nTTTTTTTTTTAC\n>2\nA\n>2\nCCGA\n";
+    write_dataset_cache(load_set_dataset(fasta), DatasetKind::Sets, directory / "dataset.nwds");
+
+    std::ifstream file(directory / "dataset.nwds", std::ios::binary);
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+static DatasetCacheHeader header_of(const std::vector<char> &bytes)
+{
+    DatasetCacheHeader header{};
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    return header;
+}
+
+/// @brief Writes the cache with the value at a file offset replaced, and tells if reading it exits
+template <typename T>
+static bool rejects(std::vector<char> bytes, uint64_t offset, T value)
+{
+    std::memcpy(bytes.data() + offset, &value, sizeof(value));
+    const auto path = directory / "corrupted.nwds";
+    std::ofstream(path, std::ios::binary).write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    return exits([&]
+                 { read_dataset_cache(path, DatasetKind::Sets); });
+}
+
+static void reads_back_the_store()
+{
+    const auto bytes = cache_bytes();
+    const auto store = read_dataset_cache(directory / "dataset.nwds", DatasetKind::Sets);
+    CHECK(store.size() == 5);
+    CHECK(store.number_of_sets() == 3);
+    CHECK(store.set_size(2) == 2);
+    CHECK(store.length(0) == 37);
+    CHECK(!rejects(bytes, 0, header_of(bytes)));
+}
+
+static void rejects_sequences_out_of_the_data()
+{
+    const auto bytes = cache_bytes();
+    const auto header = header_of(bytes);
+
+    // the last sequence starts past the data, or ends past it
+    CHECK(rejects(bytes, header.offsets_offset + 4 * sizeof(uint64_t), uint64_t{header.data_size + 8}));
+    CHECK(rejects(bytes, header.offsets_offset + 4 * sizeof(uint64_t), uint64_t{header.data_size}));
+    CHECK(rejects(bytes, header.lengths_offset + 4 * sizeof(uint32_t), uint32_t{1000}));
+    // an offset wrapping around once the sequence size is added
+    CHECK(rejects(bytes, header.offsets_offset, ~uint64_t{0}));
+}
+
+static void rejects_invalid_sets()
+{
+    const auto bytes = cache_bytes();
+    const auto header = header_of(bytes);
+
+    // sets going backward, not starting at the first sequence or not ending at the last one
+    CHECK(rejects(bytes, header.set_offsets_offset + 2 * sizeof(uint64_t), uint64_t{1}));
+    CHECK(rejects(bytes, header.set_offsets_offset, uint64_t{1}));
+    CHECK(rejects(bytes, header.set_offsets_offset + 3 * sizeof(uint64_t), uint64_t{4}));
+    CHECK(rejects(bytes, header.set_offsets_offset + 3 * sizeof(uint64_t), uint64_t{6}));
+}
+
+static void rejects_sections_out_of_the_file()
+{
+    const auto bytes = cache_bytes();
+    auto header = header_of(bytes);
+    header.number_of_sequences = ~uint64_t{0} / 4;
+    CHECK(rejects(bytes, 0, header));
+
+    header = header_of(bytes);
+    header.data_size = ~uint64_t{0};
+    CHECK(rejects(bytes, 0, header));
+
+    header = header_of(bytes);
+    header.offsets_offset += 4;
+    CHECK(rejects(bytes, 0, header));
+}
+
+int main()
+{
+    std::filesystem::create_directories(directory);
+    reads_back_the_store();
+    rejects_sequences_out_of_the_data();
+    rejects_invalid_sets();
+    rejects_sections_out_of_the_file();
+    std::filesystem::remove_all(directory);
+    return report("dataset cache");
+}
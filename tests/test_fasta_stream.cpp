@@ -0,0 +1,59 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "../src/fasta.hpp"
+
+static const auto path = std::filesystem::temp_directory_path() / ("test_fasta_stream." + std::to_string(getpid()) + ".fa");
+
+/// @brief Writes a set fasta file, one record of 100 nucleotides per set id, in the given order
+static const std::filesystem::path &set_file(const std::vector<int> &ids)
+{
+    std::ofstream file(path);
+    for (const auto id : ids)
+        file << ">set " << id << "\n"
+             << std::string(100, "ACGT"[id & 3]) << "\n";
+    return path;
+}
+
+/// @brief Streams a file by windows of about two records, returns the size of each set streamed
+static std::vector<size_t> stream(const std::filesystem::path &filename)
+{
+    FastaSetStream sets(filename, 220, SIZE_MAX);
+    std::vector<size_t> sizes;
+    while (auto window = sets.next())
+        for (size_t s = 0; s < window->number_of_sets(); s++)
+            sizes.push_back(window->set_size(s));
+    return sizes;
+}
+
+static void streams_contiguous_sets()
+{
+    const auto sizes = stream(set_file({0, 0, 0, 1, 2, 2, 7, -3, -3, 4, 4, 4, 4, 4}));
+    CHECK((sizes == std::vector<size_t>{3, 1, 2, 1, 2, 5}));
+}
+
+static void exits_on_a_set_coming_back()
+{
+    // right after the previous window, within a window, and several windows later
+    CHECK(exits([]
+                { stream(set_file({0, 1, 0})); }));
+    CHECK(exits([]
+                { stream(set_file({0, 1, 2, 3, 4, 5, 6, 7, 8, 0})); }));
+    CHECK(exits([]
+                { stream(set_file({5, 6, -1, 2, 3, 4, 8, 9, 10, 11, -1})); }));
+}
+
+int main()
+{
+    streams_contiguous_sets();
+    exits_on_a_set_coming_back();
+    std::filesystem::remove(path);
+    return report("fasta stream");
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "check.hpp"
+#include "../src/dataset_cache.hpp"
+
+static const auto path = std::filesystem::temp_directory_path() / ("test_pair_list." + std::to_string(getpid()) + ".txt");
+
+/// @brief Writes a pair list file with the given content
+static const std::filesystem::path &pair_file(const std::string &content)
+{
+    std::ofstream(path) << content;
+    return path;
+}
+
+static bool same(const std::vector<SequencePair> &pairs, const std::vector<SequencePair> &expected)
+{
+    if (pairs.size() != expected.size())
+        return false;
+    for (size_t i = 0; i < pairs.size(); i++)
+        if (pairs[i].first != expected[i].first || pairs[i].second != expected[i].second)
+            return false;
+    return true;
+}
+
+static void reads_pairs_in_file_order()
+{
+    const auto pairs = load_pair_list(pair_file("0 12\n12 345\n7 7\n345 0\n"), 346);
+    CHECK(same(pairs, {{0, 12}, {12, 345}, {7, 7}, {345, 0}}));
+}
+
+static void skips_comments_and_empty_lines()
+{
+    const auto pairs = load_pair_list(pair_file("# header\n\n  # indented comment\n1 2\n \t\n3\t4\r\n5   6"), 7);
+    CHECK(same(pairs, {{1, 2}, {3, 4}, {5, 6}}));
+}
+
+static void reads_an_empty_list()
+{
+    CHECK(load_pair_list(pair_file(""), 10).empty());
+    CHECK(load_pair_list(pair_file("# nothing\n\n"), 10).empty());
+}
+
+static void rejects_invalid_lines()
+{
+    // a single index, not a number, negative, out of the dataset
+    CHECK(exits([]
+                { load_pair_list(pair_file("0 1\n2\n"), 10); }));
+    CHECK(exits([]
+                { load_pair_list(pair_file("a b\n"), 10); }));
+    CHECK(exits([]
+                { load_pair_list(pair_file("-1 2\n"), 10); }));
+    CHECK(exits([]
+                { load_pair_list(pair_file("0 10\n"), 10); }));
+    CHECK(exits([]
+                { load_pair_list(pair_file("4294967296 0\n"), 10); }));
+    CHECK(exits([]
+                { load_pair_list(path.string() + ".missing", 10); }));
+}
+
+int main()
+{
+    reads_pairs_in_file_order();
+    skips_comments_and_empty_lines();
+    reads_an_empty_list();
+    rejects_invalid_lines();
+    std::filesystem::remove(path);
+    return report("pair list");
+}
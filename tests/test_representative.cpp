@@ -0,0 +1,144 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "../src/dataset_cache.hpp"
+#include "../src/representative.hpp"
+
+static const auto path = std::filesystem::temp_directory_path() / ("test_representative." + std::to_string(getpid()) + ".fa");
+
+/// @brief Dataset of the given sets, written to a fasta file and read back
+static SequenceStore dataset(const std::vector<std::vector<std::string>> &sets)
+{
+    std::ofstream file(path);
+    for (size_t s = 0; s < sets.size(); s++)
+        for (size_t m = 0; m < sets[s].size(); m++)
+            file << ">set " << s << " member " << m << "\n"
+                 << sets[s][m] << "\n";
+    file.close();
+    return load_set_dataset(path);
+}
+
+/// @brief Medoid by its definition: the least sum of squared distances of the k-mer profiles, the first one on ties
+static uint32_t brute_force_medoid(const SequenceStore &store, size_t s)
+{
+    const auto begin = store.set_begin(s);
+    uint32_t best = 0;
+    double best_distance = 0;
+    for (size_t m = 0; m < store.set_size(s); m++)
+    {
+        const auto x = kmer_profile(store, begin + m);
+        double distance = 0;
+        for (size_t o = 0; o < store.set_size(s); o++)
+        {
+            const auto y = kmer_profile(store, begin + o);
+            for (size_t e = 0; e < x.size(); e++)
+            {
+                const auto d = static_cast<double>(x[e]) - static_cast<double>(y[e]);
+                distance += d * d;
+            }
+        }
+        if (m == 0 || distance < best_distance)
+        {
+            best = static_cast<uint32_t>(m);
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+static std::string random_sequence(std::mt19937 &random, size_t length)
+{
+    std::string sequence(length, 'A');
+    for (auto &base : sequence)
+        base = "ACGT"[random() % 4];
+    return sequence;
+}
+
+static void medoid_is_the_closest_member()
+{
+    // members are mutations of a common ancestor, one of them is the ancestor itself
+    std::mt19937 random(7);
+    std::vector<std::vector<std::string>> sets;
+    for (size_t s = 0; s < 40; s++)
+    {
+        const auto ancestor = random_sequence(random, 100 + random() % 400);
+        std::vector<std::string> members;
+        const auto k = 1 + random() % 12;
+        for (size_t m = 0; m < k; m++)
+        {
+            auto member = ancestor;
+            for (size_t e = 0; e < random() % 60; e++)
+                member[random() % member.size()] = "ACGT"[random() % 4];
+            members.push_back(member.substr(0, member.size() - random() % 20));
+        }
+        sets.push_back(members);
+    }
+    sets.push_back({std::string(200, 'A'), random_sequence(random, 200), std::string(200, 'A')});
+
+    const auto store = dataset(sets);
+    const auto medoids = choose_representatives(store, Representative::Medoid);
+    for (size_t s = 0; s < store.number_of_sets(); s++)
+        CHECK(medoids[s] == brute_force_medoid(store, s));
+
+    // two identical members: the first one is chosen
+    CHECK(medoids.back() == 0);
+}
+
+static void longest_and_first()
+{
+    const auto store = dataset({{"ACGT", "ACGTACGT", "ACG", "ACGTACGA"}, {"ACGTA"}, {"AC", "ACGTAC"}});
+
+    const auto longest = choose_representatives(store, Representative::Longest);
+    CHECK(longest[0] == 1); // the first one of the longest
+    CHECK(longest[1] == 0);
+    CHECK(longest[2] == 1);
+
+    // a representative given by the input is the first sequence of its set
+    for (const auto r : choose_representatives(store, Representative::First))
+        CHECK(r == 0);
+}
+
+static void star_results_follow_the_members()
+{
+    // the results of a set are its members in order, the representative skipped
+    for (size_t k = 2; k < 10; k++)
+        for (size_t representative = 0; representative < k; representative++)
+        {
+            size_t expected = 0;
+            for (size_t member = 0; member < k; member++)
+                if (member != representative)
+                    CHECK(star_index(representative, member) == expected++);
+            CHECK(expected == k - 1);
+        }
+}
+
+static void triangular_results_follow_the_pairs()
+{
+    // the pairs (i, j), i < j, of a set in row order
+    for (size_t n = 2; n < 40; n++)
+    {
+        size_t expected = 0;
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = i + 1; j < n; j++)
+                CHECK(triangular_index(i, j, n) == expected++);
+        CHECK(expected == sum_integers(n));
+    }
+}
+
+int main()
+{
+    medoid_is_the_closest_member();
+    longest_and_first();
+    star_results_follow_the_members();
+    triangular_results_follow_the_pairs();
+    std::filesystem::remove(path);
+    return report("representative");
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright 2022 - UPMEM
+ */
+
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "../src/dataset_cache.hpp"
+#include "../src/score_matrix.hpp"
+
+static const auto directory = std::filesystem::temp_directory_path() / ("test_score_matrix." + std::to_string(getpid()));
+
+static const NwParameters params{2, -4, 4, 2, 128};
+
+/// @brief Score stored at a triangular index by the tests
+static int32_t score_of(size_t index) { return static_cast<int32_t>(index * 7 % 1000) - 500; }
+
+static void shards_are_balanced()
+{
+    std::mt19937 random(3);
+    for (const size_t n : {0, 1, 2, 3, 10, 100, 1000})
+        for (size_t shards = 1; shards <= 9; shards++)
+        {
+            std::vector<uint32_t> lengths(n);
+            for (auto &l : lengths)
+                l = 50 + random() % 3000;
+
+            // load of a row, the pairs with the following sequences
+            auto row_load = [&](size_t i)
+            {
+                uint64_t load = 0;
+                for (size_t j = i + 1; j < n; j++)
+                    load += lengths[i] + lengths[j] - 1;
+                return load;
+            };
+            uint64_t total = 0;
+            uint64_t biggest = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                total += row_load(i);
+                biggest = std::max(biggest, row_load(i));
+            }
+
+            // shards are contiguous and cover all the rows, each one within a row of its share
+            size_t next = 0;
+            for (size_t s = 0; s < shards; s++)
+            {
+                const auto [first, last] = score_shard(lengths, s, shards);
+                CHECK(first == next);
+                CHECK(first <= last);
+                next = last;
+
+                uint64_t load = 0;
+                for (size_t i = first; i < last; i++)
+                    load += row_load(i);
+                CHECK(load <= total / shards + biggest);
+                CHECK(load + biggest >= total / shards);
+            }
+            CHECK(next == n);
+        }
+}
+
+/// @brief Writes the shards of a matrix of n sequences in a directory, their scores set to score_of
+static std::vector<std::filesystem::path> write_shards(const std::filesystem::path &path, size_t n, size_t shards, uint64_t fingerprint)
+{
+    std::filesystem::create_directories(path);
+    std::vector<uint32_t> lengths(n, 100);
+    std::vector<std::filesystem::path> paths;
+    for (size_t s = 0; s < shards; s++)
+    {
+        const auto rows = score_shard(lengths, s, shards);
+        paths.push_back(path / ("shard" + std::to_string(s) + ".nwsm"));
+        auto matrix = ScoreMatrix::create(paths.back(), n, ScoreType::Int32, params, fingerprint, rows);
+
+        std::vector<int32_t> values;
+        for (auto index = row_begin(rows.first_row, n); index < row_begin(rows.last_row, n); index++)
+            values.push_back(score_of(index));
+        matrix.store(row_begin(rows.first_row, n), values);
+        matrix.finish();
+    }
+    return paths;
+}
+
+static std::vector<ScoreMatrix> open_all(const std::vector<std::filesystem::path> &paths)
+{
+    std::vector<ScoreMatrix> shards;
+    for (const auto &path : paths)
+        shards.push_back(ScoreMatrix::open(path));
+    return shards;
+}
+
+static void merge_covers_the_matrix()
+{
+    constexpr size_t n = 60;
+    const auto paths = write_shards(directory / "good", n, 4, 42);
+
+    // in any order
+    auto shards = open_all({paths[2], paths[0], paths[3], paths[1]});
+    const auto merged = merge_shards(directory / "merged.nwsm", shards);
+
+    CHECK(merged.info().first_score == 0);
+    CHECK(merged.info().number_of_scores == sum_integers(n));
+    CHECK(merged.info().complete == 1);
+    CHECK(merged.info().fingerprint == 42);
+    bool all = true;
+    for (size_t index = 0; index < sum_integers(n); index++)
+        all &= merged.at(index) == score_of(index);
+    CHECK(all);
+
+    // the merged file is read back the same
+    const auto reopened = ScoreMatrix::open(directory / "merged.nwsm");
+    CHECK(reopened.info().fingerprint == 42);
+    CHECK(reopened.score(59, 3) == score_of(triangular_index(3, 59, n)));
+}
+
+static void merge_rejects_invalid_shards()
+{
+    constexpr size_t n = 60;
+    const auto paths = write_shards(directory / "good", n, 4, 42);
+
+    // a missing shard, at the start, in the middle or at the end
+    for (size_t missing = 0; missing < paths.size(); missing++)
+    {
+        auto some = paths;
+        some.erase(some.begin() + static_cast<std::ptrdiff_t>(missing));
+        CHECK(exits([&]
+                    { auto shards = open_all(some); merge_shards(directory / "bad.nwsm", shards); }));
+    }
+
+    // a shard given twice
+    CHECK(exits([&]
+                { auto shards = open_all({paths[0], paths[1], paths[1], paths[2], paths[3]}); merge_shards(directory / "bad.nwsm", shards); }));
+
+    // a shard of another dataset of the same size
+    const auto other = write_shards(directory / "other", n, 4, 43);
+    CHECK(exits([&]
+                { auto shards = open_all({paths[0], other[1], paths[2], paths[3]}); merge_shards(directory / "bad.nwsm", shards); }));
+
+    // a shard whose run did not finish
+    const auto rows = score_shard(std::vector<uint32_t>(n, 100), 3, 4);
+    ScoreMatrix::create(directory / "stopped.nwsm", n, ScoreType::Int32, params, 42, rows);
+    CHECK(exits([&]
+                { auto shards = open_all({paths[0], paths[1], paths[2], directory / "stopped.nwsm"}); merge_shards(directory / "bad.nwsm", shards); }));
+
+    // the same shards are merged
+    CHECK(!exits([&]
+                 { auto shards = open_all(paths); merge_shards(directory / "good.nwsm", shards); }));
+}
+
+static void merge_skips_empty_shards()
+{
+    // a shard of no row starts at the end of the matrix
+    constexpr size_t n = 60;
+    auto matrix = ScoreMatrix::create(directory / "whole.nwsm", n, ScoreType::Int32, params, 42);
+    const auto empty = ScoreMatrix::create(directory / "empty.nwsm", n, ScoreType::Int32, params, 42, ScoreShard{n, n});
+    CHECK(empty.info().first_score == sum_integers(n));
+    CHECK(!exits([&]
+                 { matrix.merge(empty); }));
+
+    // a single sequence has no pair, every shard is empty
+    CHECK(!exits([&]
+                 { auto shards = open_all(write_shards(directory / "single", 1, 3, 42)); merge_shards(directory / "single.nwsm", shards); }));
+}
+
+static void open_rejects_other_versions()
+{
+    const auto paths = write_shards(directory / "versions", 10, 1, 42);
+    std::vector<char> bytes;
+    {
+        std::ifstream file(paths[0], std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    auto rewrite = [&](const std::vector<char> &content)
+    {
+        const auto path = directory / "version.nwsm";
+        std::ofstream(path, std::ios::binary).write(content.data(), static_cast<std::streamsize>(content.size()));
+        return path;
+    };
+
+    CHECK(!exits([&]
+                 { ScoreMatrix::open(rewrite(bytes)); }));
+    for (const uint32_t version : {0u, 1u, 3u})
+    {
+        auto other = bytes;
+        std::memcpy(other.data() + offsetof(ScoreMatrixHeader, version), &version, sizeof(version));
+        CHECK(exits([&]
+                    { ScoreMatrix::open(rewrite(other)); }));
+    }
+
+    // a file shorter than the header
+    CHECK(exits([&]
+                { ScoreMatrix::open(rewrite({bytes.begin(), bytes.begin() + sizeof(ScoreMatrixHeader) - 1})); }));
+}
+
+static void fingerprint_tells_datasets_apart()
+{
+    auto fingerprint = [](const std::string &fasta)
+    {
+        const auto path = directory / "dataset.fa";
+        std::ofstream(path) << fasta;
+        return dataset_fingerprint(load_seq_dataset(path));
+    };
+
+    const auto reference = fingerprint(">0\nACGTACGTAC\n>1\nGGATC\n");
+    CHECK(reference == fingerprint(">a\nACGTA\nCGTAC\n>b\nGGATC\n")); // headers and line breaks are not part of it
+    CHECK(reference != fingerprint(">0\nACGTACGTAG\n>1\nGGATC\n")); // last nucleotide of a sequence
+    CHECK(reference != fingerprint(">0\nACGTACGTA\n>1\nCGGATC\n")); // same nucleotides, other lengths
+    CHECK(reference != fingerprint(">1\nGGATC\n>0\nACGTACGTAC\n")); // other order
+    CHECK(reference != fingerprint(">0\nACGTACGTAC\n"));
+
+    // the dataset cache of the same sequences
+    const auto store = load_seq_dataset(directory / "dataset.fa");
+    write_dataset_cache(store, DatasetKind::Sequences, directory / "dataset.nwds");
+    CHECK(dataset_fingerprint(load_seq_dataset(directory / "dataset.nwds")) == dataset_fingerprint(store));
+}
+
+int main()
+{
+    std::filesystem::create_directories(directory);
+    shards_are_balanced();
+    merge_covers_the_matrix();
+    merge_rejects_invalid_shards();
+    merge_skips_empty_shards();
+    open_rejects_other_versions();
+    fingerprint_tells_datasets_apart();
+    std::filesystem::remove_all(directory);
+    return report("score matrix");
+}